@@ -0,0 +1,737 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+#include <new>
+#include <string>
+#include <utility>
+
+#include "denoise.hpp"
+#include "image.hpp"
+#include "scenes.hpp"
+#include "sppm.hpp"
+
+
+std::atomic<std::size_t> allocations{0};
+
+void *operator new(std::size_t size) {
+    ++allocations;
+    if (void *p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+void operator delete(void *p) noexcept { std::free(p); }
+
+
+template<class F> double seconds(F &&f) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    std::chrono::duration<double> d = std::chrono::steady_clock::now()-start;
+    return d.count();
+}
+
+// Renders one pass of scenes::drops with and without the BVH.
+void bench_bvh(std::size_t n, std::int64_t xs, std::int64_t ys) {
+    auto linear = scenes::drops::scene(n, 1);
+    auto bvh = scenes::drops::scene(n, 1);
+    linear.bvh.nodes.clear();
+    for (auto *scene : {&linear, &bvh}) {
+        auto camera = scenes::drops::camera(*scene);
+        Screen screen; screen.initialize_data(xs, ys);
+        double t = seconds([&] { screen.capture(camera, 1); });
+        std::printf("drops n=%zu %s: %.3f s, %.0f paths/s\n", n,
+            scene == &bvh ? "bvh" : "linear", t, xs*ys/t);
+    }
+}
+
+// A BVH over boxes at x = 2^i, which the SAH splits off a few at a time
+// from the far end. Passes if the tree stays within Bvh::MAX_DEPTH and a
+// ray down the row still finds the nearest box. The row stops short of
+// Real's largest power of two, so the float build tests a shallower tree.
+bool bench_bvh_depth(std::size_t n) {
+    n = std::min<std::size_t>(n, std::numeric_limits<Real>::max_exponent-1);
+    std::vector<Aabb> boxes;
+    for (std::size_t i=0; i<n; ++i) {
+        Real x = std::ldexp(Real(1), i);
+        boxes.push_back({{x-Real(.5), -.5, -.5}, {x+Real(.5), .5, .5}});
+    }
+    Bvh bvh; auto order = bvh.build(boxes);
+    int depth = 0;
+    std::vector<int> depths(bvh.nodes.size());
+    for (std::size_t i=0; i<bvh.nodes.size(); ++i) {
+        depth = std::max(depth, depths[i]);
+        if (bvh.nodes[i].count == 0)
+            depths[i+1] = depths[bvh.nodes[i].first] = depths[i] + 1;
+    }
+    Ray ray{{-1., 0., 0.}, {1., 0., 0.}}; Real t;
+    std::int64_t found = bvh.nearest(ray, t, [&](std::uint32_t i) {
+        return boxes[order[i]].lo.x() - ray.o.x();
+    });
+    bool ok = depth <= Bvh::MAX_DEPTH && found >= 0 && order[found] == 0;
+    std::printf("bvh of %zu skewed boxes: depth %d, nearest %lld%s\n", n,
+        depth, found < 0 ? -1ll : (long long) order[found],
+        ok ? "" : ", FAILED");
+    return ok;
+}
+
+// Distance from the hit at t to the surface of `drop`, relative to its
+// height 6|s|: |f|/|grad f| for f = x^2 + z^2 - R(y)^2 in long double,
+// where R = 3s(2u - u^2 - u^3) and u = sqrt(y/6s) as in WaterDrop.
+double waterdrop_distance(const shapes::WaterDrop &drop, const Ray &ray,
+        double t) {
+    using L = long double;
+    L s = drop.s, p[3];
+    for (int k=0; k<3; ++k)
+        p[k] = L(ray.o[k]) + t*L(ray.d[k]) - L(drop.o[k]);
+    L u = std::sqrt(std::max(p[1] / (6*s), L(0)));
+    L r = 3*s*(2*u - u*u - u*u*u);
+    L f = p[0]*p[0] + p[2]*p[2] - r*r;
+    L dy = -1.5L*s*(2 - u - u*u)*(2 - 2*u - 3*u*u);
+    L g = std::sqrt(4*p[0]*p[0] + 4*p[2]*p[2] + dy*dy);
+    return double(std::abs(f) / g / std::abs(6*s));
+}
+
+// Times WaterDrop::intersects_with against the eigensolver reference on
+// rays aimed at the drop's bounding box, from anywhere around it and from
+// origins within 1e-6 to 1 of its axis, where the polynomial is worst
+// conditioned. There the two t differ by more than 1e-5 relative, the
+// eigensolver's being the worse, so hits are judged by their distance
+// from the surface: TOLERANCE of the drop's height plus the rounding of t
+// to Real. Rays with |d.y| < 1e-3 are left out: the polynomial is
+// ill-conditioned there for both solvers. Passes if the two agree on
+// which rays hit and no Sturm hit is beyond the tolerance.
+bool bench_waterdrop(std::size_t n) {
+    constexpr double TOLERANCE = 1e-8;
+    constexpr double ROUNDING = std::numeric_limits<Real>::epsilon();
+    using uniform = std::uniform_real_distribution<>;
+    shapes::WaterDrop drop{{0., 0., 0.}, 6.};
+    bool ok = true;
+    for (bool axial : {false, true}) {
+        CounterRng rng{1, axial}; std::vector<Ray> rays;
+        for (std::size_t i=0; i<n; ++i) {
+            double r = axial ? std::pow(10., uniform(-6., 0.)(rng)) : 100.;
+            Eigen::Vector3d o{uniform(-r, r)(rng),
+                uniform(-100., 100.)(rng), uniform(-r, r)(rng)};
+            Eigen::Vector3d p{uniform(-12., 12.)(rng),
+                uniform(0., 36.)(rng), uniform(-12., 12.)(rng)};
+            rays.push_back(
+                    {o.cast<Real>(), (p-o).normalized().cast<Real>()});
+        }
+        std::vector<double> t_fast(n), t_ref(n);
+        double fast = seconds([&] {
+            for (std::size_t i=0; i<n; ++i)
+                t_fast[i] = drop.intersects_with(rays[i]);
+        });
+        double ref = seconds([&] {
+            for (std::size_t i=0; i<n; ++i)
+                t_ref[i] = drop.intersects_with_reference(rays[i]);
+        });
+        double err = 0., far_fast = 0., far_ref = 0.;
+        std::size_t hits = 0, mismatches = 0, beyond = 0;
+        for (std::size_t i=0; i<n; ++i) {
+            hits += t_ref[i] > 0.;
+            if ((t_fast[i] > 0.) != (t_ref[i] > 0.)) {
+                ++mismatches;
+                continue;
+            }
+            if (t_ref[i] <= 0. || std::abs(rays[i].d.y()) < 1e-3)
+                continue;
+            err = std::max(err, std::abs(t_fast[i]-t_ref[i]) / t_ref[i]);
+            double distance = waterdrop_distance(drop, rays[i], t_fast[i]);
+            far_fast = std::max(far_fast, distance);
+            beyond += distance > TOLERANCE + ROUNDING*t_fast[i]/(6.*drop.s);
+            far_ref = std::max(
+                    far_ref, waterdrop_distance(drop, rays[i], t_ref[i]));
+        }
+        bool passed = !mismatches && !beyond;
+        std::printf("waterdrop%s sturm: %.1f ns/ray, eigen: %.1f ns/ray, "
+            "%zu/%zu hits, %zu mismatches, max rel diff %.3g, max distance "
+            "sturm %.3g (%zu beyond tolerance), eigen %.3g%s\n",
+            axial ? " near axis" : "", fast/n*1e9, ref/n*1e9, hits, n,
+            mismatches, err, far_fast, beyond, far_ref,
+            passed ? "" : ", FAILED");
+        ok &= passed;
+    }
+    return ok;
+}
+
+// Nearest-hit queries for one pass of camera rays, one ray at a time and
+// as packets.
+void bench_packets(const char *name, Scene &scene, Camera &camera,
+        std::int64_t xs, std::int64_t ys) {
+    std::vector<Ray> rays;
+    for (std::int64_t x=0; x<xs; ++x)
+        for (std::int64_t y=0; y<ys; ++y) {
+            auto rng = CounterRng::for_path(1, y*xs+x, 0);
+            rays.push_back(camera.ray(x-xs/2, ys/2-y, rng));
+        }
+    double sum_scalar = 0., sum_packet = 0.;
+    double scalar = seconds([&] {
+        for (auto &ray : rays) {
+            Real t; scene.intersects_with(ray, t); sum_scalar += t;
+        }
+    });
+    double packet = seconds([&] {
+        for (std::size_t i=0; i+PACKET<=rays.size(); i+=PACKET) {
+            RayPacket<PACKET> p; Real t[PACKET]; Object *nearest[PACKET];
+            for (int j=0; j<PACKET; ++j)
+                p.set(j, rays[i+j]);
+            scene.intersects_with(p, t, nearest);
+            for (int j=0; j<PACKET; ++j)
+                sum_packet += t[j];
+        }
+    });
+    std::printf("%s primary rays scalar: %.0f rays/s, packet: %.0f rays/s"
+        " (checksum %.6g / %.6g)\n", name, rays.size()/scalar,
+        rays.size()/packet, sum_scalar, sum_packet);
+}
+
+// One pass with each integrator.
+void bench_integrators(const char *name, Camera &camera,
+        std::int64_t xs, std::int64_t ys) {
+    for (auto integrator : {Integrator::recursive, Integrator::wavefront}) {
+        Screen screen; screen.initialize_data(xs, ys);
+        double t = seconds([&] { screen.capture(camera, 1, 1, integrator); });
+        std::printf("%s %s: %.3f s, %.0f paths/s\n", name,
+            integrator == Integrator::recursive ? "recursive" : "wavefront",
+            t, xs*ys/t);
+    }
+}
+
+// Heap allocations during one pass of each integrator, after a warm-up
+// pass; the hot path must not allocate.
+bool bench_allocations(const char *name, Camera &camera,
+        std::int64_t xs, std::int64_t ys) {
+    bool ok = true;
+    for (auto integrator : {Integrator::recursive, Integrator::wavefront,
+            Integrator::nee}) {
+        Screen screen; screen.initialize_data(xs, ys);
+        screen.capture(camera, 1, 1, integrator);
+        std::size_t before = allocations;
+        screen.capture(camera, 1, 1, integrator);
+        std::size_t n = allocations - before;
+        std::printf("%s %s allocations per pass: %zu%s\n", name,
+            integrator == Integrator::recursive ? "recursive"
+            : integrator == Integrator::wavefront ? "wavefront" : "nee",
+            n, n ? ", FAILED" : "");
+        ok &= !n;
+    }
+    return ok;
+}
+
+// One pass at every thread count from 1 to the maximum.
+void bench_scaling(const char *name, Camera &camera,
+        std::int64_t xs, std::int64_t ys) {
+    int max_threads = 1;
+#ifdef _OPENMP
+    max_threads = omp_get_max_threads();
+#endif
+    double t1 = 0.;
+    for (int n=1; n<=max_threads; ++n) {
+#ifdef _OPENMP
+        omp_set_num_threads(n);
+#endif
+        Screen screen; screen.initialize_data(xs, ys);
+        double t = seconds([&] { screen.capture(camera, 1); });
+        if (n == 1)
+            t1 = t;
+        std::printf("%s %lldx%lld threads=%d: %.3f s, %.0f paths/s, "
+            "efficiency %.2f\n", name, (long long) xs, (long long) ys, n, t,
+            xs*ys/t, t1/(t*n));
+    }
+#ifdef _OPENMP
+    omp_set_num_threads(max_threads);
+#endif
+}
+
+// Per-pixel radiance of `passes` passes with next-event estimation and
+// seed 2, which no measured render uses; the reference that convergence
+// is measured against.
+std::vector<Eigen::Vector3d> reference_render(Camera &camera,
+        std::int64_t xs, std::int64_t ys, std::int64_t passes,
+        Sequence sequence = Sequence::random) {
+    Screen screen; screen.initialize_data(xs, ys);
+    screen.sequence = sequence;
+    screen.capture(camera, 2, passes, Integrator::nee);
+    return radiance(screen);
+}
+
+// Root mean square difference per colour channel, over the pixels set in
+// `mask` if one is given.
+double rmse(const std::vector<Eigen::Vector3d> &a,
+        const std::vector<Eigen::Vector3d> &b,
+        const std::vector<char> *mask = nullptr) {
+    double sum = 0.; std::size_t n = 0;
+    for (std::size_t i=0; i<a.size(); ++i)
+        if (!mask || (*mask)[i]) {
+            sum += (a[i] - b[i]).squaredNorm(); ++n;
+        }
+    return std::sqrt(sum / (n*3));
+}
+
+// Pixels whose camera ray through the pixel's centre first hits a diffuse
+// surface close to a transparent object, within its bounds grown by half
+// their size on every side: the floor around and beneath the glass
+// spheres of saturn2, where they focus the light into caustics.
+std::vector<char> caustic_mask(Camera &camera,
+        std::int64_t xs, std::int64_t ys) {
+    std::vector<Aabb> glass;
+    camera.scene->for_each_object([&](Object &obj) {
+        if (obj.material() == Material::transparent) {
+            Aabb box = obj.bounds(); Vector3 half = (box.hi - box.lo) / 2;
+            glass.push_back({box.lo - half, box.hi + half});
+        }
+    });
+    std::vector<char> mask(xs*ys, 0);
+    for (std::int64_t y=0; y<ys; ++y)
+        for (std::int64_t x=0; x<xs; ++x) {
+            Real u = ((x-xs/2) + .5) * camera.d;
+            Real v = ((ys/2-y) + .5) * camera.d;
+            Ray ray{camera.e, (camera.n + camera.a*u + camera.b*v)
+                .normalized()};
+            Real t; Object *hit = camera.scene->intersects_with(ray, t);
+            if (!hit || !hit->diffuse())
+                continue;
+            Vector3 p = ray.o + t*ray.d;
+            for (auto &box : glass)
+                if ((p.array() >= box.lo.array()).all()
+                        && (p.array() <= box.hi.array()).all())
+                    mask[y*xs+x] = 1;
+        }
+    return mask;
+}
+
+// RMSE against a high-sample reference versus wall-clock time, for path
+// tracing with and without next-event estimation and, with it, for each
+// sample sequence. The camera's pixels are enlarged by `zoom` so that a
+// small image still covers the whole view.
+void bench_convergence(const char *name, Camera camera,
+        std::int64_t xs, std::int64_t ys, double zoom) {
+    struct Config {
+        const char *name; Integrator integrator; Sequence sequence;
+    };
+    const Config configs[] = {
+        {"recursive", Integrator::recursive, Sequence::random},
+        {"nee", Integrator::nee, Sequence::random},
+        {"nee+stratified", Integrator::nee, Sequence::stratified},
+        {"nee+halton", Integrator::nee, Sequence::halton},
+        {"nee+sobol", Integrator::nee, Sequence::sobol}};
+    camera.d *= zoom;
+    auto reference = reference_render(camera, xs, ys, 8192);
+    for (auto &config : configs) {
+        Screen screen; screen.initialize_data(xs, ys); double t = 0.;
+        screen.sequence = config.sequence;
+        for (std::int64_t passes=16; passes<=1024; passes*=4) {
+            t += seconds([&] {
+                screen.capture(camera, 1,
+                        passes-screen.count, config.integrator);
+            });
+            std::printf("%s %s spp=%lld: %.3f s, rmse %.4f\n", name,
+                config.name, (long long) passes, t,
+                rmse(radiance(screen), reference));
+        }
+    }
+}
+
+// A diffuse wall lit by a square light above it and nothing else, where
+// the first bounce's light point and diffuse direction are the draws that
+// the low-discrepancy sequences stratify. Passes if next-event estimation
+// with Sobol points ends with a lower RMSE against a high-spp reference
+// than with random numbers.
+bool bench_sequences(std::int64_t xs, std::int64_t ys) {
+    using R = objects::DefiniteRectangleSCO;
+    auto wall = std::make_unique<R>(), light = std::make_unique<R>();
+    wall->base.o << 300., 150., 0.; wall->base.n << -1., 0., 0.;
+    wall->base.a << 0., -1., 0.; wall->base.b << 0., 0., 1.;
+    wall->base.am = wall->base.bm = 300.;
+    wall->base._prop = {.1, .9, 0.}; wall->base._color << .75, .75, .75;
+    wall->base._radiation << 0., 0., 0.;
+    light->base.o << 200., 37.5, 250.; light->base.n << 0., 0., 1.;
+    light->base.a << 0., -1., 0.; light->base.b << 1., 0., 0.;
+    light->base.am = light->base.bm = 75.;
+    light->base._prop = {.1, 0., 0.}; light->base._color << 0., 0., 0.;
+    light->base._radiation << 8., 8., 8.;
+    Scene scene;
+    scene.push_back(std::move(wall)); scene.push_back(std::move(light));
+    scene.build();
+    Camera camera; camera.e << -200., 0., 150.; camera.n << 500., 0., 0.;
+    camera.a << 0., -1., 0.; camera.b << 0., 0., 1.;
+    camera.d = 300./xs; camera.scene = &scene;
+    auto reference = reference_render(camera, xs, ys, 4096, Sequence::sobol);
+    double last[2];
+    for (auto sequence : {Sequence::random, Sequence::sobol}) {
+        Screen screen; screen.initialize_data(xs, ys);
+        screen.sequence = sequence;
+        for (std::int64_t passes=16; passes<=256; passes*=4) {
+            screen.capture(camera, 1, passes-screen.count, Integrator::nee);
+            last[sequence == Sequence::sobol]
+                = rmse(radiance(screen), reference);
+            std::printf("wall nee+%s spp=%lld: rmse %.4f\n",
+                sequence == Sequence::sobol ? "sobol" : "random",
+                (long long) passes, last[sequence == Sequence::sobol]);
+        }
+    }
+    if (last[1] < last[0])
+        return true;
+    std::printf("wall: sobol is not better than random\n");
+    return false;
+}
+
+// SPPM against path tracing with next-event estimation at equal time, on
+// the whole image and on the caustic_mask() pixels, where photon mapping
+// is meant to pay off.
+void bench_caustics(const char *name, Camera camera,
+        std::int64_t xs, std::int64_t ys, double zoom) {
+    camera.d *= zoom;
+    auto reference = reference_render(camera, xs, ys, 8192);
+    auto mask = caustic_mask(camera, xs, ys);
+    std::printf("%s caustic mask: %lld of %lld pixels\n", name,
+        (long long) std::count(mask.begin(), mask.end(), 1),
+        (long long) mask.size());
+    Screen path; path.initialize_data(xs, ys);
+    Screen photon; photon.initialize_data(xs, ys);
+    PhotonMapper mapper; mapper.camera = &camera;
+    mapper.photons_per_pass = 50000;
+    double tp = 0., tm = 0.;
+    for (std::int64_t passes=16; passes<=256; passes*=4) {
+        tm += seconds([&] {
+            mapper.capture(photon, 1, passes-mapper.passes);
+        });
+        while (tp < tm)
+            tp += seconds([&] {
+                path.capture(camera, 1, 16, Integrator::nee);
+            });
+        auto sppm = radiance(photon), nee = radiance(path);
+        std::printf("%s sppm passes=%lld: %.3f s, rmse %.4f (caustics "
+            "%.4f); nee spp=%lld: %.3f s, rmse %.4f (caustics %.4f)\n",
+            name, (long long) passes, tm, rmse(sppm, reference),
+            rmse(sppm, reference, &mask), (long long) path.count, tp,
+            rmse(nee, reference), rmse(nee, reference, &mask));
+    }
+}
+
+// Four NEE passes through the virtual Scene and through a TypedScene of
+// the same objects. Passes if the two images are identical.
+bool bench_typed(const char *name, Scene &scene, Scene &typed,
+        Camera camera, std::int64_t xs, std::int64_t ys) {
+    Screen virtual_, typed_;
+    virtual_.initialize_data(xs, ys); typed_.initialize_data(xs, ys);
+    camera.scene = &scene;
+    double slow = seconds([&] {
+        virtual_.capture(camera, 1, 4, Integrator::nee);
+    });
+    camera.scene = &typed;
+    double fast = seconds([&] {
+        typed_.capture(camera, 1, 4, Integrator::nee);
+    });
+    double diff = 0.;
+    for (std::int64_t y=0; y<ys; ++y)
+        for (std::int64_t x=0; x<xs; ++x)
+            diff = std::max(diff, (virtual_(x, y)-typed_(x, y)).norm());
+    std::printf("%s %lldx%lld: virtual %.3f s, typed %.3f s, speedup %.2f, "
+        "max diff %.3g%s\n", name, (long long) xs, (long long) ys,
+        slow, fast, slow/fast, diff, diff == 0. ? "" : ", FAILED");
+    return diff == 0.;
+}
+
+// Error of the raw and the denoised image against a high-spp reference
+// as samples accumulate, and the time the denoised image needs to match
+// the raw image's error at 1024 spp, if it does so with fewer. The error
+// is given on the radiance and on the displayed values, clamped to 1 as
+// data2png.py does: the former is dominated by the pixels on the edges of
+// the lights, whose noise is in how much of the pixel the light covers,
+// which the filter keeps.
+void bench_denoise(const char *name, Camera camera,
+        std::int64_t xs, std::int64_t ys, double zoom) {
+    auto display = [](std::vector<Eigen::Vector3d> pixels) {
+        for (auto &pixel : pixels)
+            pixel = pixel.cwiseMin(1.);
+        return pixels;
+    };
+    camera.d *= zoom;
+    auto reference = reference_render(camera, xs, ys, 8192);
+    auto shown = display(reference);
+    struct Step {
+        std::int64_t passes; double time, raw[2], denoised[2];
+    };
+    std::vector<Step> steps;
+    Screen screen; screen.initialize_data(xs, ys); screen.record_features();
+    Denoiser denoiser; double t = 0.;
+    for (std::int64_t passes=4; passes<=1024; passes*=4) {
+        t += seconds([&] {
+            screen.capture(camera, 1, passes-screen.count, Integrator::nee);
+        });
+        std::vector<Eigen::Vector3d> denoised;
+        double filter = seconds([&] { denoised = denoiser(screen); });
+        auto pixels = radiance(screen);
+        steps.push_back({passes, t, {rmse(pixels, reference),
+            rmse(display(pixels), shown)}, {rmse(denoised, reference),
+            rmse(display(denoised), shown)}});
+        auto &step = steps.back();
+        std::printf("%s spp=%lld: %.3f s, rmse %.4f (display %.4f); "
+            "denoised in %.3f s, rmse %.4f (display %.4f)\n", name,
+            (long long) passes, t, step.raw[0], step.raw[1], filter,
+            step.denoised[0], step.denoised[1]);
+    }
+    auto &last = steps.back();
+    for (int i=0; i<2; ++i) {
+        const char *metric = i ? "display rmse" : "rmse";
+        auto end = steps.end() - 1;
+        auto it = std::find_if(steps.begin(), end, [&](Step &step) {
+            return step.denoised[i] <= last.raw[i];
+        });
+        if (it == end)
+            std::printf("%s: denoised does not reach %s %.4f of %lld spp "
+                "raw with fewer samples\n", name, metric, last.raw[i],
+                (long long) last.passes);
+        else
+            std::printf("%s: denoised reaches %s %.4f at %lld spp (%.3f s) "
+                "vs %lld spp (%.3f s) raw\n", name, metric, last.raw[i],
+                (long long) it->passes, it->time, (long long) last.passes,
+                last.time);
+    }
+}
+
+// Results of the reproducible suite run by `bench --json FILE`: one JSON
+// object per measurement, also echoed to stdout.
+struct Report {
+    std::string records;
+    void add(const char *kind, const std::string &name,
+            std::initializer_list<std::pair<const char *, double>> metrics) {
+        std::string record = std::string("{\"kind\": \"") + kind
+            + "\", \"name\": \"" + name + "\"";
+        for (auto &[key, value] : metrics) {
+            char buffer[32];
+            std::snprintf(buffer, sizeof(buffer), "%.6g", value);
+            record += std::string(", \"") + key + "\": " + buffer;
+        }
+        record += "}";
+        std::printf("%s\n", record.c_str());
+        records += (records.empty() ? "\n    " : ",\n    ") + record;
+    }
+    bool write(const char *filename) const {
+        int threads = 1;
+#ifdef _OPENMP
+        threads = omp_get_max_threads();
+#endif
+        std::FILE *file = std::fopen(filename, "w");
+        if (!file)
+            return false;
+        std::fprintf(file, "{\n  \"compiler\": \"%s\",\n  \"precision\": "
+            "\"%s\",\n  \"threads\": %d,\n  \"results\": [%s\n  ]\n}\n",
+            __VERSION__, sizeof(Real) == 4 ? "float" : "double", threads,
+            records.c_str());
+        return std::fclose(file) == 0;
+    }
+};
+
+volatile double sink;
+
+// ns per intersects_with() call on rays that hit the shape, that enter its
+// bounding box but miss, and that miss the box. Rays start on a sphere
+// around the box and aim at random points of a cube three times its size;
+// a class with no rays (a rectangle's box is the rectangle) is left out.
+template<class Shape> void bench_shape(Report &report, const char *name,
+        const Shape &shape, std::size_t n) {
+    using uniform = std::uniform_real_distribution<>;
+    constexpr Real inf = std::numeric_limits<Real>::infinity();
+    Aabb box = shape.bounds();
+    Real e = (box.hi - box.lo).maxCoeff();
+    shapes::Sphere around{box.center(), 4*e};
+    CounterRng rng{1, 0}; std::vector<Ray> rays[3];
+    for (std::size_t i=0; i<10*n; ++i) {
+        if (rays[0].size() >= n && rays[1].size() >= n && rays[2].size() >= n)
+            break;
+        Vector3 o = around.sample(uniform(0., 1.)(rng),
+            uniform(0., 1.)(rng));
+        Vector3 p = box.center() + Real(1.5)*e*Eigen::Vector3d{
+            uniform(-1., 1.)(rng), uniform(-1., 1.)(rng),
+            uniform(-1., 1.)(rng)}.cast<Real>();
+        Ray ray{o, (p-o).normalized()};
+        int k = shape.intersects_with(ray) > 0. ? 0
+            : box.intersects_with(ray, ray.d.cwiseInverse(), inf) ? 1 : 2;
+        if (rays[k].size() < n)
+            rays[k].push_back(ray);
+    }
+    const char *classes[3] = {"hit", "miss", "rejected"};
+    for (int k=0; k<3; ++k) {
+        if (rays[k].empty())
+            continue;
+        double sum = 0.;
+        double t = seconds([&] {
+            for (auto &ray : rays[k])
+                sum += shape.intersects_with(ray);
+        });
+        sink = sum;
+        report.add("intersect", std::string(name) + "/" + classes[k],
+            {{"rays", double(rays[k].size())},
+             {"ns_per_intersection", t/rays[k].size()*1e9}});
+    }
+}
+
+// ns per RayTransformer::diffuse_reflect() and refract() call, on random
+// directions entering a surface with a random normal.
+void bench_transforms(Report &report, std::size_t n) {
+    using uniform = std::uniform_real_distribution<>;
+    shapes::Sphere unit{{0., 0., 0.}, 1.};
+    CounterRng rng{1, 0}; std::vector<Vector3> d, normal;
+    for (std::size_t i=0; i<n; ++i) {
+        d.push_back(unit.sample(uniform(0., 1.)(rng), uniform(0., 1.)(rng)));
+        Vector3 m = unit.sample(
+            uniform(0., 1.)(rng), uniform(0., 1.)(rng));
+        normal.push_back(d[i].dot(m) > 0. ? -m : m);
+    }
+    Vector3 sum{0., 0., 0.};
+    double diffuse = seconds([&] {
+        for (std::size_t i=0; i<n; ++i)
+            sum += RayTransformer{d[i], normal[i]}.diffuse_reflect(rng);
+    });
+    double refract = seconds([&] {
+        for (std::size_t i=0; i<n; ++i)
+            sum += RayTransformer{d[i], normal[i]}.refract(1./1.5, rng).first;
+    });
+    sink = sum.sum();
+    report.add("transform", "diffuse_reflect",
+        {{"ns_per_call", diffuse/n*1e9}});
+    report.add("transform", "refract", {{"ns_per_call", refract/n*1e9}});
+}
+
+// `passes` passes with seed 1 at several resolutions of the same view and
+// at 1, 2, 4, ... threads and the maximum; efficiency is relative to one
+// thread at the same resolution.
+void bench_capture(Report &report, const char *name, const Camera &camera,
+        std::int64_t passes) {
+    int max_threads = 1;
+#ifdef _OPENMP
+    max_threads = omp_get_max_threads();
+#endif
+    std::vector<int> threads;
+    for (int n=1; n<max_threads; n*=2)
+        threads.push_back(n);
+    threads.push_back(max_threads);
+    for (std::int64_t xs : {160, 400, 800}) {
+        std::int64_t ys = xs*3/4; Camera c = camera; c.d *= 1600./xs;
+        double t1 = 0.;
+        for (int n : threads) {
+#ifdef _OPENMP
+            omp_set_num_threads(n);
+#endif
+            Screen screen; screen.initialize_data(xs, ys);
+            double t = seconds([&] { screen.capture(c, 1, passes); });
+            if (n == 1)
+                t1 = t;
+            report.add("capture", name, {{"xs", double(xs)},
+                {"ys", double(ys)}, {"threads", double(n)},
+                {"passes", double(passes)}, {"seconds", t},
+                {"paths_per_second", xs*ys*passes/t},
+                {"efficiency", t1/(t*n)}});
+        }
+    }
+#ifdef _OPENMP
+    omp_set_num_threads(max_threads);
+#endif
+}
+
+// Renders threebody and saturn2 at 200x150 with next event estimation and
+// seed 1, saving each image as DIR/<scene>-<precision>.dat. Once the double
+// build has saved its images there, the float build also reports its RMSE
+// and mean against them, relative to their mean; compare the RMSE with the
+// noise of `passes` passes, not with zero.
+int bench_precision(const char *dir, std::int64_t passes) {
+    const char *precision = sizeof(Real) == 4 ? "float" : "double";
+    auto threebody = scenes::threebody::scene();
+    auto saturn2 = scenes::saturn2::scene();
+    std::pair<const char *, Camera> cameras[] = {
+        {"threebody", scenes::threebody::camera(threebody)},
+        {"saturn2", scenes::saturn2::camera(saturn2)}};
+    Report report;
+    for (auto &[name, camera] : cameras) {
+        std::int64_t xs = 200, ys = 150; camera.d *= 1600./xs;
+        Screen screen; screen.initialize_data(xs, ys);
+        double t = seconds([&] {
+            screen.capture(camera, 1, passes, Integrator::nee);
+        });
+        std::string prefix = std::string(dir) + "/" + name;
+        if (!screen.to_file((prefix + "-" + precision + ".dat").c_str())) {
+            std::perror(prefix.c_str());
+            return 1;
+        }
+        report.add("precision", std::string(name) + "/" + precision,
+            {{"passes", double(passes)}, {"seconds", t},
+            {"paths_per_second", xs*ys*passes/t}});
+        Screen reference;
+        if (sizeof(Real) == 8
+                || !reference.from_file((prefix + "-double.dat").c_str())
+                || reference.xs != xs || reference.ys != ys)
+            continue;
+        auto a = radiance(screen), b = radiance(reference);
+        double sum_a = 0., sum_b = 0.;
+        for (std::size_t i=0; i<a.size(); ++i) {
+            sum_a += a[i].sum(); sum_b += b[i].sum();
+        }
+        double mean = sum_b / (3*a.size());
+        report.add("precision", std::string(name) + "/error",
+            {{"rmse", rmse(a, b) / mean}, {"mean", sum_a / sum_b - 1.}});
+    }
+    return 0;
+}
+
+// The reproducible suite: fixed inputs, machine-readable output.
+int bench_suite(const char *filename) {
+    Report report;
+    bench_shape(report, "sphere", shapes::Sphere{{0., 0., 0.}, 20.}, 1000000);
+    bench_shape(report, "rectangle", shapes::DefiniteRectangle{
+        {0., 0., 0.}, {0., 0., 1.}, {1., 0., 0.}, {0., 1., 0.}, 300., 225.},
+        1000000);
+    bench_shape(report, "waterdrop", shapes::WaterDrop{{0., 0., 0.}, 6.},
+        1000000);
+    bench_transforms(report, 1000000);
+    auto threebody = scenes::threebody::scene();
+    bench_capture(report, "threebody",
+        scenes::threebody::camera(threebody), 4);
+    auto saturn = scenes::saturn::scene();
+    bench_capture(report, "saturn", scenes::saturn::camera(saturn), 4);
+    if (!report.write(filename)) {
+        std::perror(filename);
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc == 3 && !std::strcmp(argv[1], "--json"))
+        return bench_suite(argv[2]);
+    if (argc == 3 && !std::strcmp(argv[1], "--precision"))
+        return bench_precision(argv[2], 256);
+    std::size_t n = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000;
+    bool waterdrop = bench_waterdrop(1000000);
+    auto scene = scenes::threebody::scene();
+    auto camera = scenes::threebody::camera(scene);
+    bench_packets("threebody", scene, camera, 1600, 1200);
+    bench_integrators("threebody", camera, 400, 300);
+    bench_scaling("threebody", camera, 1600, 1200);
+    auto saturn = scenes::saturn::scene();
+    auto saturn_camera = scenes::saturn::camera(saturn);
+    bench_integrators("saturn", saturn_camera, 400, 300);
+    objects::TypedAll typed{scenes::threebody::scene()};
+    bool typed_ok = bench_typed(
+            "threebody", scene, typed, camera, 400, 300);
+    objects::TypedAll saturn_typed{scenes::saturn::scene()};
+    typed_ok &= bench_typed(
+            "saturn", saturn, saturn_typed, saturn_camera, 400, 300);
+    bench_convergence("threebody", camera, 80, 60, 20.);
+    bench_convergence("saturn", saturn_camera, 80, 60, 20.);
+    bench_denoise("threebody", camera, 160, 120, 10.);
+    bench_denoise("saturn", saturn_camera, 160, 120, 10.);
+    auto saturn2 = scenes::saturn2::scene();
+    bench_caustics("saturn2", scenes::saturn2::camera(saturn2), 80, 60, 20.);
+    bool ok = waterdrop & typed_ok & bench_bvh_depth(300)
+        & bench_sequences(80, 60)
+        & bench_allocations("threebody", camera, 160, 120)
+        & bench_allocations("saturn", saturn_camera, 160, 120);
+    bench_bvh(n, 320, 240);
+    return ok ? 0 : 1;
+}
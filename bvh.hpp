@@ -0,0 +1,193 @@
+#pragma once
+
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+#include "geometry.hpp"
+
+
+// Bounding volume hierarchy built with the binned surface area heuristic
+// and stored as a flat, depth-first node array: the left child of an
+// interior node immediately follows it, the right child is at `first`.
+// Past MAX_DEPTH a node becomes a leaf however many primitives it holds,
+// so that skewed input, such as boxes at geometrically growing distances,
+// cannot outgrow the fixed traversal stack.
+struct Bvh {
+    struct Node {
+        Aabb box; std::uint32_t first, count;
+    };
+    static constexpr int BINS = 12, LEAF_SIZE = 2;
+    // A node at depth d is popped with at most d siblings stacked.
+    static constexpr int MAX_DEPTH = 60, STACK = MAX_DEPTH + 2;
+    static constexpr double TRAVERSAL_COST = 1., INTERSECTION_COST = 2.;
+    std::vector<Node> nodes;
+
+    // Returns the permutation the primitives must be stored in, so that
+    // leaf ranges index them contiguously.
+    std::vector<std::uint32_t> build(const std::vector<Aabb> &boxes) {
+        std::vector<std::uint32_t> order(boxes.size());
+        std::iota(order.begin(), order.end(), 0u);
+        nodes.clear();
+        if (!boxes.empty())
+            __build(boxes, order, 0, order.size(), 0);
+        return order;
+    }
+    std::uint32_t __build(const std::vector<Aabb> &boxes,
+            std::vector<std::uint32_t> &order,
+            std::uint32_t first, std::uint32_t count, int depth) {
+        std::uint32_t index = nodes.size();
+        nodes.push_back({Aabb::empty(), first, count});
+        Aabb box = Aabb::empty(), centers = Aabb::empty();
+        for (std::uint32_t i=first; i<first+count; ++i) {
+            box.extend(boxes[order[i]]);
+            centers.extend(boxes[order[i]].center());
+        }
+        nodes[index].box = box;
+        if (count <= LEAF_SIZE || depth >= MAX_DEPTH)
+            return index;
+        int axis; double best = INTERSECTION_COST * count * box.area();
+        std::uint32_t mid = __split(
+                boxes, order, first, count, box, centers, axis, best);
+        if (mid == first)
+            return index;
+        __build(boxes, order, first, mid-first, depth+1);
+        nodes[index].first = __build(
+                boxes, order, mid, first+count-mid, depth+1);
+        nodes[index].count = 0;
+        return index;
+    }
+    // Picks the cheapest binned SAH split; returns `first` when no split is
+    // cheaper than a leaf, otherwise partitions `order` and returns the
+    // start of the right half.
+    std::uint32_t __split(const std::vector<Aabb> &boxes,
+            std::vector<std::uint32_t> &order,
+            std::uint32_t first, std::uint32_t count, const Aabb &box,
+            const Aabb &centers, int &axis, double &best) {
+        double parent_area = box.area();
+        int best_bin = -1; axis = -1;
+        auto bin_of = [&](std::uint32_t i, int k) {
+            double extent = centers.hi[k] - centers.lo[k];
+            int b = (boxes[i].center()[k] - centers.lo[k]) / extent * BINS;
+            return b < BINS ? b : BINS - 1;
+        };
+        for (int k=0; k<3; ++k) {
+            if (centers.hi[k] - centers.lo[k] <= EPS)
+                continue;
+            Aabb bin_box[BINS]; std::uint32_t bin_count[BINS] = {};
+            for (auto &b : bin_box)
+                b = Aabb::empty();
+            for (std::uint32_t i=first; i<first+count; ++i) {
+                int b = bin_of(order[i], k);
+                bin_box[b].extend(boxes[order[i]]); ++bin_count[b];
+            }
+            double right_area[BINS]; std::uint32_t right_count[BINS];
+            Aabb acc = Aabb::empty(); std::uint32_t n = 0;
+            for (int b=BINS-1; b>0; --b) {
+                acc.extend(bin_box[b]); n += bin_count[b];
+                right_area[b] = acc.area(); right_count[b] = n;
+            }
+            acc = Aabb::empty(); n = 0;
+            for (int b=0; b<BINS-1; ++b) {
+                acc.extend(bin_box[b]); n += bin_count[b];
+                if (n == 0 || right_count[b+1] == 0)
+                    continue;
+                double cost = TRAVERSAL_COST * parent_area
+                    + INTERSECTION_COST * (n*acc.area()
+                        + right_count[b+1]*right_area[b+1]);
+                if (cost < best) {
+                    best = cost; axis = k; best_bin = b;
+                }
+            }
+        }
+        if (axis < 0)
+            return first;
+        auto it = std::partition(order.begin()+first,
+                order.begin()+first+count,
+                [&](std::uint32_t i) { return bin_of(i, axis) <= best_bin; });
+        return it - order.begin();
+    }
+
+    // Calls hit(i) for every primitive whose leaf the ray reaches before
+    // the nearest hit found so far; hit returns the primitive's distance,
+    // or 0. on a miss. Returns the index of the nearest primitive closer
+    // than t_max, e.g. a hit found elsewhere, or -1.
+    template<class F> std::int64_t nearest(const Ray &ray, Real &t, F &&hit,
+            Real t_max = std::numeric_limits<Real>::infinity()) const {
+        Vector3 d_inv = ray.d.cwiseInverse();
+        std::uint32_t stack[STACK]; int top = 0;
+        std::int64_t found = -1; t = t_max;
+        if (!nodes.empty())
+            stack[top++] = 0;
+        while (top > 0) {
+            const Node &node = nodes[stack[--top]];
+            if (!node.box.intersects_with(ray, d_inv, t))
+                continue;
+            if (node.count == 0) {
+                std::uint32_t left = &node - nodes.data() + 1;
+                bool near_left = ray.d.dot(nodes[left].box.center()
+                    - nodes[node.first].box.center()) <= 0.;
+                stack[top++] = near_left ? node.first : left;
+                stack[top++] = near_left ? left : node.first;
+                continue;
+            }
+            for (std::uint32_t i=node.first; i<node.first+node.count; ++i) {
+                Real _t = hit(i);
+                if (_t > 0. && _t < t) {
+                    found = i;
+                    t = _t;
+                }
+            }
+        }
+        if (found < 0)
+            t = 0.;
+        return found;
+    }
+
+    // Packet traversal: a node is entered when any lane's ray reaches it
+    // before that lane's nearest hit so far. hit(i, t) fills the per-lane
+    // distances to primitive i, 0. on a miss. Lanes only take hits closer
+    // than their t_max, if given.
+    template<int W, class F> void nearest(const RayPacket<W> &rays,
+            Real (&t)[W], std::int64_t (&found)[W], F &&hit,
+            const Real *t_max = nullptr) const {
+        constexpr Real inf = std::numeric_limits<Real>::infinity();
+        Real d_inv[3][W], _t[W];
+        for (int k=0; k<3; ++k)
+            for (int i=0; i<W; ++i)
+                d_inv[k][i] = 1 / rays.d[k][i];
+        for (int i=0; i<W; ++i) {
+            t[i] = t_max ? t_max[i] : inf; found[i] = -1;
+        }
+        std::uint32_t stack[STACK]; int top = 0;
+        if (!nodes.empty())
+            stack[top++] = 0;
+        Vector3 d_mean{0., 0., 0.};
+        for (int i=0; i<W; ++i)
+            d_mean += rays[i].d;
+        while (top > 0) {
+            const Node &node = nodes[stack[--top]];
+            if (!node.box.intersects_with(rays, d_inv, t))
+                continue;
+            if (node.count == 0) {
+                std::uint32_t left = &node - nodes.data() + 1;
+                bool near_left = d_mean.dot(nodes[left].box.center()
+                    - nodes[node.first].box.center()) <= 0.;
+                stack[top++] = near_left ? node.first : left;
+                stack[top++] = near_left ? left : node.first;
+                continue;
+            }
+            for (std::uint32_t j=node.first; j<node.first+node.count; ++j) {
+                hit(j, _t);
+                for (int i=0; i<W; ++i)
+                    if (_t[i] > 0. && _t[i] < t[i]) {
+                        found[i] = j;
+                        t[i] = _t[i];
+                    }
+            }
+        }
+        for (int i=0; i<W; ++i)
+            if (found[i] < 0)
+                t[i] = 0.;
+    }
+};
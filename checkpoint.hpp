@@ -0,0 +1,200 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "objects.hpp"
+
+
+// Identifies what a Screen was rendering: the camera and, for every object
+// in any order, its material, bounds, power, area and parameters (colour,
+// probabilities, refractive index, texture), so that a scene hashes the
+// same however it stores its objects. A resumed run must match.
+inline std::uint64_t scene_hash(Camera &camera) {
+    auto add = [](std::uint64_t &h, double v) {
+        std::uint64_t bits; std::memcpy(&bits, &v, 8);
+        h = CounterRng::mix(h ^ bits);
+    };
+    auto add3 = [&](std::uint64_t &h, const auto &v) {
+        add(h, v.x()); add(h, v.y()); add(h, v.z());
+    };
+    std::uint64_t h = 0, objects = 0;
+    add3(h, camera.e); add3(h, camera.n); add3(h, camera.a);
+    add3(h, camera.b); add(h, camera.d);
+    camera.scene->for_each_object([&](Object &obj) {
+        std::uint64_t g = 0; Aabb box = obj.bounds();
+        add(g, double(obj.material())); add3(g, box.lo); add3(g, box.hi);
+        add(g, obj.power()); add(g, obj.area());
+        obj.parameters([&](double v) { add(g, v); });
+        objects += g;
+    });
+    return CounterRng::mix(h ^ objects);
+}
+
+// Snapshot of a Screen in its in-memory tile layout behind a versioned
+// header. A snapshot is written through a shared mapping of a temporary
+// file, synced and renamed over the previous one, so a crash at any point
+// leaves either the old or the new checkpoint intact. save_async() copies
+// the buffers and writes them on a background thread; rendering continues.
+// The first-hit features follow the radiance when the screen records them.
+struct Checkpoint {
+    static constexpr char MAGIC[8] = {'W', 'D', 'S', 'C', 'R', 'E', 'E', 'N'};
+    static constexpr std::uint64_t VERSION = 2;
+    struct Header {
+        char magic[8]; std::uint64_t version, scene;
+        std::int64_t xs, ys, tile, count, sequence, features;
+    };
+    std::string path; std::uint64_t scene;
+    std::vector<char> buffer; std::thread writer; bool ok = true;
+    // Set by load() when a file exists at `path` but was not resumed.
+    bool rejected = false;
+
+    Checkpoint(std::string _path, std::uint64_t _scene)
+        : path(std::move(_path)), scene(_scene) {}
+    ~Checkpoint() { wait(); }
+    static std::size_t __size(
+            std::int64_t xs, std::int64_t ys, bool features) {
+        std::size_t tiles = ((xs+Screen::TILE-1) / Screen::TILE)
+            * ((ys+Screen::TILE-1) / Screen::TILE);
+        std::size_t pixels = tiles * Screen::TILE*Screen::TILE;
+        return sizeof(Header) + pixels*4*8 + tiles*2*8
+            + (features ? pixels*7*8 + tiles*8 : 0);
+    }
+    void __snapshot(const Screen &screen) {
+        bool features = !screen.albedo.empty();
+        buffer.resize(__size(screen.xs, screen.ys, features));
+        Header header{{}, VERSION, scene, screen.xs, screen.ys, Screen::TILE,
+            screen.count, std::int64_t(screen.sequence), features};
+        std::memcpy(header.magic, MAGIC, 8);
+        char *p = buffer.data();
+        auto put = [&](const void *src, std::size_t n) {
+            std::memcpy(p, src, n); p += n;
+        };
+        put(&header, sizeof(Header));
+        put(screen.data.data(), screen.data.size()*sizeof(Eigen::Vector3d));
+        put(screen.moment.data(), screen.moment.size()*8);
+        put(screen.samples.data(), screen.samples.size()*8);
+        put(screen.moment_samples.data(), screen.moment_samples.size()*8);
+        if (!features)
+            return;
+        put(screen.albedo.data(),
+                screen.albedo.size()*sizeof(Eigen::Vector3d));
+        put(screen.normal.data(),
+                screen.normal.size()*sizeof(Eigen::Vector3d));
+        put(screen.depth.data(), screen.depth.size()*8);
+        put(screen.feature_samples.data(), screen.feature_samples.size()*8);
+    }
+    bool __write() {
+        std::string tmp = path + "." + std::to_string(::getpid()) + ".tmp";
+        int fd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            return false;
+        bool done = ::ftruncate(fd, buffer.size()) == 0;
+        if (done) {
+            void *map = ::mmap(nullptr, buffer.size(),
+                    PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            done = map != MAP_FAILED;
+            if (done) {
+                std::memcpy(map, buffer.data(), buffer.size());
+                done = ::msync(map, buffer.size(), MS_SYNC) == 0;
+                ::munmap(map, buffer.size());
+            }
+        }
+        done = ::fsync(fd) == 0 && done;
+        ::close(fd);
+        return done && std::rename(tmp.c_str(), path.c_str()) == 0;
+    }
+    // Waits for a pending asynchronous save; false if it failed.
+    bool wait() {
+        if (writer.joinable())
+            writer.join();
+        return ok;
+    }
+    bool save(const Screen &screen) {
+        wait(); __snapshot(screen);
+        return ok = __write();
+    }
+    void save_async(const Screen &screen) {
+        wait(); __snapshot(screen);
+        writer = std::thread([this] { ok = __write(); });
+    }
+    // Reads only the header of the checkpoint at `path`.
+    static bool peek(const std::string &path, Header &header) {
+        std::FILE *file = std::fopen(path.c_str(), "rb");
+        if (!file)
+            return false;
+        bool done = std::fread(&header, sizeof(Header), 1, file) == 1
+            && !std::memcmp(header.magic, MAGIC, 8);
+        std::fclose(file);
+        return done;
+    }
+    // Restores a checkpoint of this scene at xs by ys; false, leaving the
+    // screen untouched, if there is none or, setting `rejected`, if it does
+    // not match. Features are restored if the screen records them and the
+    // checkpoint has them, otherwise the screen's start from zero.
+    bool load(Screen &screen, std::int64_t xs, std::int64_t ys) {
+        rejected = false;
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        rejected = true;
+        off_t size = ::lseek(fd, 0, SEEK_END);
+        void *map = size >= off_t(sizeof(Header)) ? ::mmap(nullptr, size,
+                PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+        ::close(fd);
+        if (map == MAP_FAILED) {
+            std::fprintf(stderr, "%s: unreadable, not resumed\n",
+                    path.c_str());
+            return false;
+        }
+        const char *p = static_cast<const char *>(map);
+        Header header; std::memcpy(&header, p, sizeof(Header));
+        const char *reason = nullptr;
+        if (std::memcmp(header.magic, MAGIC, 8) || header.version != VERSION
+                || header.tile != Screen::TILE
+                || std::size_t(size)
+                    != __size(header.xs, header.ys, header.features))
+            reason = "not a checkpoint of this version";
+        else if (header.xs != xs || header.ys != ys)
+            reason = "resolution differs";
+        else if (header.scene != scene)
+            reason = "scene differs";
+        if (reason) {
+            std::fprintf(
+                    stderr, "%s: %s, not resumed\n", path.c_str(), reason);
+            ::munmap(map, size);
+            return false;
+        }
+        rejected = false;
+        screen.initialize_data(xs, ys);
+        screen.count = header.count;
+        screen.sequence = Sequence(header.sequence);
+        p += sizeof(Header);
+        auto get = [&](void *dst, std::size_t n) {
+            std::memcpy(dst, p, n); p += n;
+        };
+        get(screen.data.data(), screen.data.size()*sizeof(Eigen::Vector3d));
+        get(screen.moment.data(), screen.moment.size()*8);
+        get(screen.samples.data(), screen.samples.size()*8);
+        get(screen.moment_samples.data(), screen.moment_samples.size()*8);
+        if (header.features && !screen.albedo.empty()) {
+            get(screen.albedo.data(),
+                    screen.albedo.size()*sizeof(Eigen::Vector3d));
+            get(screen.normal.data(),
+                    screen.normal.size()*sizeof(Eigen::Vector3d));
+            get(screen.depth.data(), screen.depth.size()*8);
+            get(screen.feature_samples.data(),
+                    screen.feature_samples.size()*8);
+        }
+        ::munmap(map, size);
+        return true;
+    }
+};
@@ -9,7 +9,7 @@ def main():
         count = int.from_bytes(data.read(8), sys.byteorder)
         xs = int.from_bytes(data.read(8), sys.byteorder)
         ys = int.from_bytes(data.read(8), sys.byteorder)
-        img = np.fromfile(data, dtype=np.float64) / count
+        img = np.fromfile(data, dtype=np.float64, count=xs*ys*3) / count
         img = np.where(img > 1., 1., img)
         img = (img*255).astype(np.uint8).reshape(ys, xs, 3)
         cv2.imwrite('out/scene.png', img)
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "objects.hpp"
+
+
+// Edge-avoiding a-trous wavelet filter (Dammertz et al., 2010) with the
+// variance-guided luminance weight of SVGF (Schied et al., 2017). Needs a
+// Screen that recorded features (Screen::record_features()). Radiance is
+// divided by the first-hit albedo so that texture is not blurred, filtered
+// ITERATIONS times with a 5x5 B3-spline kernel whose taps are 2^i pixels
+// apart, and multiplied back. Taps are weighted down across differences in
+// normal, depth, albedo and luminance, the latter relative to the standard
+// error estimated from Screen::moment, which is filtered alongside.
+// Finally each pixel is blended back towards its raw mean where the filter
+// moved it further than its noise explains (__blend()), so that the output
+// converges to the raw image as samples accumulate.
+struct Denoiser {
+    static constexpr int ITERATIONS = 5;
+    static constexpr double SIGMA_L = 4., SIGMA_Z = 1., SIGMA_A = .1;
+    static constexpr int NORMAL_POWER = 7;  // weight (n_p . n_q)^(2^7)
+    static constexpr double MIN_ALBEDO = 1e-2;
+    static constexpr double KERNEL[5] = {1./16, 1./4, 3./8, 1./4, 1./16};
+    std::int64_t xs, ys, xt, yt;
+    std::vector<Eigen::Vector3d> color, next, albedo, normal, raw;
+    std::vector<double> variance, variance_next, depth, gradient;
+    std::vector<double> raw_variance, difference;
+
+    // Reads the per-pixel means out of the screen's tiled sums.
+    void __load(const Screen &screen) {
+        xs = screen.xs; ys = screen.ys; xt = screen.xt; yt = screen.yt;
+        std::size_t size = xs*ys;
+        color.resize(size); next.resize(size); albedo.resize(size);
+        normal.resize(size); variance.resize(size);
+        variance_next.resize(size); depth.resize(size); gradient.resize(size);
+        for (std::int64_t y=0; y<ys; ++y)
+            for (std::int64_t x=0; x<xs; ++x) {
+                std::int64_t i = screen.index(x, y), p = y*xs+x;
+                std::int64_t k = (y/Screen::TILE)*xt + x/Screen::TILE;
+                double n = std::max<std::int64_t>(screen.samples[k], 1);
+                double f = std::max<std::int64_t>(
+                        screen.feature_samples[k], 1);
+                std::int64_t m = screen.moment_samples[k];
+                Eigen::Vector3d a = (screen.albedo[i]/f).cwiseMax(MIN_ALBEDO);
+                Eigen::Vector3d c = screen.data[i] / n;
+                double l = luminance(c), la = luminance(a);
+                albedo[p] = a; color[p] = c.cwiseQuotient(a);
+                normal[p] = screen.normal[i].normalized();
+                if (screen.normal[i].isZero())
+                    normal[p].setZero();
+                depth[p] = screen.depth[i] / f;
+                variance[p] = m > 1
+                    ? std::max(screen.moment[i]/m - l*l, 0.) / n / (la*la)
+                    : std::numeric_limits<double>::infinity();
+            }
+        for (std::int64_t y=0; y<ys; ++y)
+            for (std::int64_t x=0; x<xs; ++x) {
+                auto at = [&](std::int64_t _x, std::int64_t _y) {
+                    return depth[std::clamp<std::int64_t>(_y, 0, ys-1)*xs
+                        + std::clamp<std::int64_t>(_x, 0, xs-1)];
+                };
+                double gx = (at(x+1, y) - at(x-1, y)) / 2.;
+                double gy = (at(x, y+1) - at(x, y-1)) / 2.;
+                gradient[y*xs+x] = std::sqrt(gx*gx + gy*gy);
+            }
+    }
+    double __weight(std::int64_t p, std::int64_t q, double offset,
+            double l_p, double sigma_l) const {
+        double w_n = 1.;
+        if (!normal[p].isZero() || !normal[q].isZero()) {
+            w_n = std::max(normal[p].dot(normal[q]), 0.);
+            for (int i=0; i<NORMAL_POWER; ++i)
+                w_n *= w_n;
+        }
+        double dz = std::abs(depth[p] - depth[q]);
+        double w_z = dz / (SIGMA_Z*gradient[p]*offset + 1e-9);
+        double w_a = (albedo[p] - albedo[q]).squaredNorm() / (SIGMA_A*SIGMA_A);
+        double w_l = std::abs(l_p - luminance(color[q])) / sigma_l;
+        return w_n * std::exp(-w_z - w_a - w_l);
+    }
+    // One a-trous pass with taps `step` pixels apart, over the pixels of
+    // screen tile k.
+    void __filter(std::int64_t k, int step) {
+        std::int64_t x0 = k%xt*Screen::TILE, y0 = k/xt*Screen::TILE;
+        std::int64_t x1 = std::min(x0+Screen::TILE, xs);
+        std::int64_t y1 = std::min(y0+Screen::TILE, ys);
+        for (std::int64_t y=y0; y<y1; ++y)
+            for (std::int64_t x=x0; x<x1; ++x) {
+                std::int64_t p = y*xs+x;
+                double l_p = luminance(color[p]);
+                double sigma_l = SIGMA_L*std::sqrt(variance[p]) + 1e-9;
+                Eigen::Vector3d sum{0., 0., 0.}; double w_sum = 0., v_sum = 0.;
+                for (int dy=-2; dy<=2; ++dy)
+                    for (int dx=-2; dx<=2; ++dx) {
+                        std::int64_t qx = x+dx*step, qy = y+dy*step;
+                        if (qx < 0 || qx >= xs || qy < 0 || qy >= ys)
+                            continue;
+                        std::int64_t q = qy*xs+qx;
+                        double w = KERNEL[dx+2] * KERNEL[dy+2] * (q == p ? 1.
+                            : __weight(p, q, step*std::hypot(dx, dy),
+                                l_p, sigma_l));
+                        sum += w * color[q]; w_sum += w;
+                        v_sum += w*w * variance[q];
+                    }
+                next[p] = sum / w_sum;
+                variance_next[p] = v_sum / (w_sum*w_sum);
+            }
+    }
+    // Moves the filtered pixel p back towards its raw mean by the weight
+    // v / (v + b^2) that minimizes the expected squared error when the raw
+    // mean has variance v and the filtered value a bias b. b^2 is the
+    // excess of the squared difference between the two over v; both are
+    // averaged over the 5x5 kernel, as single pixels are too noisy. As v
+    // falls with more samples, the filter backs off wherever it blurs.
+    void __blend(std::int64_t x, std::int64_t y) {
+        double v = 0., d = 0., w_sum = 0.;
+        for (int dy=-2; dy<=2; ++dy)
+            for (int dx=-2; dx<=2; ++dx) {
+                std::int64_t qx = x+dx, qy = y+dy;
+                if (qx < 0 || qx >= xs || qy < 0 || qy >= ys)
+                    continue;
+                double w = KERNEL[dx+2] * KERNEL[dy+2];
+                v += w * raw_variance[qy*xs+qx];
+                d += w * difference[qy*xs+qx]; w_sum += w;
+            }
+        v /= w_sum; d /= w_sum;
+        double bias = std::max(d - v, 0.);
+        if (std::isfinite(v) && v + bias > 0.) {
+            std::int64_t p = y*xs+x;
+            next[p] = raw[p] + v / (v + bias) * (color[p] - raw[p]);
+        }
+    }
+    // Returns the filtered radiance, row-major from the top.
+    std::vector<Eigen::Vector3d> operator()(const Screen &screen) {
+        __load(screen);
+        raw = color; raw_variance = variance;
+        for (int i=0; i<ITERATIONS; ++i) {
+#pragma omp parallel for schedule(dynamic)
+            for (std::int64_t k=0; k<xt*yt; ++k)
+                __filter(k, 1 << i);
+            color.swap(next); variance.swap(variance_next);
+        }
+        difference.resize(xs*ys);
+        for (std::int64_t p=0; p<xs*ys; ++p) {
+            double d = luminance(color[p] - raw[p]);
+            difference[p] = d*d;
+        }
+        next = color;
+#pragma omp parallel for schedule(dynamic)
+        for (std::int64_t y=0; y<ys; ++y)
+            for (std::int64_t x=0; x<xs; ++x)
+                __blend(x, y);
+        color.swap(next);
+        std::vector<Eigen::Vector3d> out(xs*ys);
+        for (std::size_t p=0; p<out.size(); ++p)
+            out[p] = color[p].cwiseProduct(albedo[p]);
+        return out;
+    }
+};
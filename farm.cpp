@@ -0,0 +1,258 @@
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "checkpoint.hpp"
+#include "scenefile.hpp"
+#include "shards.hpp"
+
+
+// Renders one image with several processes sharing a directory:
+//   farm coordinate DIR SHARDS PASSES XS YS SCENE [SEQUENCE]
+//   farm work DIR
+//   farm merge OUT SHARD.ckpt...
+// Shard k renders passes [k*PASSES, (k+1)*PASSES) of the whole image. The
+// coordinator writes DIR/farm.cfg, frees the shards of dead workers and,
+// once every shard is done, merges them into DIR/scene.dat. Workers load
+// the scene file named in the config, so its path must resolve the same
+// from every worker's directory. SHARDS, PASSES, XS and YS are positive;
+// SEQUENCE is one of SEQUENCES, random by default. A restarted coordinator
+// keeps DIR/farm.cfg and says so if the arguments differ from it.
+
+volatile std::sig_atomic_t interrupted = 0;
+void interrupt(int) { interrupted = 1; }
+
+constexpr double TIMEOUT = 60.;
+constexpr auto HEARTBEAT = std::chrono::seconds(15);
+constexpr auto CHECKPOINT_INTERVAL = std::chrono::minutes(1);
+constexpr auto POLL = std::chrono::seconds(1);
+
+struct Config {
+    std::uint64_t seed; std::int64_t shards, passes, xs, ys;
+    std::string scene; Sequence sequence = Sequence::random;
+    // The numbers on the first line, the scene file on the second and the
+    // sequence on the third; configs written without it use random.
+    bool from_file(const std::string &dir) {
+        std::FILE *file = std::fopen((dir + "/farm.cfg").c_str(), "rb");
+        if (!file)
+            return false;
+        unsigned long long _seed; long long _shards, _passes, _xs, _ys;
+        char path[4096], name[32];
+        bool done = std::fscanf(file, "%llu %lld %lld %lld %lld\n",
+                &_seed, &_shards, &_passes, &_xs, &_ys) == 5
+            && std::fgets(path, sizeof(path), file);
+        bool named = done && std::fscanf(file, "%31s", name) == 1;
+        std::fclose(file);
+        if (done) {
+            scene = path;
+            if (!scene.empty() && scene.back() == '\n')
+                scene.pop_back();
+            done = !scene.empty();
+        }
+        sequence = Sequence::random;
+        if (named)
+            done = done && parse_sequence(name, sequence);
+        seed = _seed; shards = _shards; passes = _passes; xs = _xs; ys = _ys;
+        return done && valid();
+    }
+    bool valid() const { return shards > 0 && passes > 0 && xs > 0 && ys > 0; }
+    // Whether the image and its shard layout are the same; seeds differ.
+    bool same(const Config &other) const {
+        return shards == other.shards && passes == other.passes
+            && xs == other.xs && ys == other.ys && scene == other.scene
+            && sequence == other.sequence;
+    }
+    bool to_file(const std::string &dir) const {
+        std::string name = dir + "/farm.cfg", tmp = name + ".tmp";
+        std::FILE *file = std::fopen(tmp.c_str(), "wb");
+        if (!file)
+            return false;
+        std::fprintf(file, "%llu %lld %lld %lld %lld\n%s\n%s\n",
+                (unsigned long long) seed, (long long) shards,
+                (long long) passes, (long long) xs, (long long) ys,
+                scene.c_str(), SEQUENCES[int(sequence)]);
+        std::fclose(file);
+        return std::rename(tmp.c_str(), name.c_str()) == 0;
+    }
+};
+
+// Touches the lock of shard k every HEARTBEAT from a background thread, so
+// that a worker whose passes take longer than TIMEOUT is not taken for
+// dead. `lost` is set once the shard is no longer this worker's.
+struct Heartbeat {
+    std::mutex mutex; std::condition_variable wake; bool stopping = false;
+    std::thread toucher; std::atomic<bool> lost{false};
+
+    void start(ShardDirectory &shards, std::int64_t k) {
+        stop();
+        stopping = false; lost = false;
+        toucher = std::thread([this, &shards, k] {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (!wake.wait_for(lock, HEARTBEAT, [&] { return stopping; }))
+                if (!shards.heartbeat(k)) {
+                    lost = true;
+                    return;
+                }
+        });
+    }
+    void stop() {
+        if (!toucher.joinable())
+            return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        toucher.join();
+    }
+    ~Heartbeat() { stop(); }
+};
+
+// Sums shard checkpoints of one scene and resolution into a single screen.
+bool merge(const std::vector<std::string> &files, Screen &total) {
+    Checkpoint::Header header;
+    if (files.empty() || !Checkpoint::peek(files[0], header))
+        return false;
+    for (std::size_t i=0; i<files.size(); ++i) {
+        Checkpoint checkpoint{files[i], header.scene}; Screen screen;
+        if (!checkpoint.load(screen, header.xs, header.ys))
+            return false;
+        if (i == 0)
+            total = std::move(screen);
+        else
+            total.merge(screen);
+    }
+    return true;
+}
+
+int coordinate(const std::string &dir, Config config) {
+    // A restarted coordinator keeps the original seed and shard layout.
+    if (Config existing; existing.from_file(dir)) {
+        if (!existing.same(config))
+            std::fprintf(stderr, "%s/farm.cfg: differs from the arguments, "
+                    "resuming %lld shards of %lld passes at %lldx%lld of %s "
+                    "(%s)\n", dir.c_str(), (long long) existing.shards,
+                    (long long) existing.passes, (long long) existing.xs,
+                    (long long) existing.ys, existing.scene.c_str(),
+                    SEQUENCES[int(existing.sequence)]);
+        config = existing;
+    } else {
+        if (SceneFile file; !file.load(config.scene))
+            return 1;
+        config.seed = std::time(nullptr);
+        if (!config.to_file(dir)) {
+            std::perror(dir.c_str());
+            return 1;
+        }
+    }
+    ShardDirectory shards{dir, config.shards, TIMEOUT};
+    while (!interrupted && !shards.finished()) {
+        if (auto freed = shards.reap())
+            std::printf("reassigning %lld shards\n", (long long) freed);
+        std::this_thread::sleep_for(POLL);
+    }
+    if (interrupted)
+        return 1;
+    std::vector<std::string> files;
+    for (std::int64_t k=0; k<config.shards; ++k)
+        files.push_back(shards.file(k, ".ckpt"));
+    Screen screen;
+    if (!merge(files, screen) || !screen.to_file((dir + "/scene.dat").c_str()))
+        return 1;
+    std::printf("merged %lld shards, %lld passes\n",
+            (long long) config.shards, (long long) screen.count);
+    return 0;
+}
+
+int work(const std::string &dir) {
+    Config config;
+    while (!config.from_file(dir))
+        if (interrupted)
+            return 1;
+        else
+            std::this_thread::sleep_for(POLL);
+    SceneFile file;
+    if (!file.load(config.scene))
+        return 1;
+    file.resize(config.xs, config.ys);
+    auto &camera = file.camera;
+    std::uint64_t hash = scene_hash(camera);
+    ShardDirectory shards{dir, config.shards, TIMEOUT};
+    while (!interrupted && !shards.finished()) {
+        std::int64_t k = shards.claim();
+        if (k < 0) {
+            std::this_thread::sleep_for(POLL);
+            continue;
+        }
+        Checkpoint checkpoint{shards.file(k, ".ckpt"), hash};
+        Screen screen; screen.interrupt = &interrupted;
+        if (!checkpoint.load(screen, config.xs, config.ys)) {
+            screen.initialize_data(config.xs, config.ys);
+            screen.sequence = config.sequence;
+        }
+        screen.first_pass = k * config.passes;
+        Heartbeat heartbeat; heartbeat.start(shards, k);
+        bool owned = true; auto last = std::chrono::steady_clock::now();
+        while (owned && screen.count < config.passes) {
+            screen.capture(camera, config.seed);
+            if (interrupted)
+                break;
+            owned = !heartbeat.lost && shards.heartbeat(k);
+            auto now = std::chrono::steady_clock::now();
+            if (now - last > CHECKPOINT_INTERVAL) {
+                checkpoint.save_async(screen);
+                last = now;
+            }
+        }
+        heartbeat.stop();
+        // An interrupted pass leaves tiles unevenly sampled; it is dropped
+        // and the shard resumes from its last checkpoint.
+        if (owned && !interrupted && checkpoint.save(screen))
+            shards.finish(k);
+        else
+            shards.release(k);
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    std::signal(SIGINT, interrupt);
+    std::signal(SIGTERM, interrupt);
+    if ((argc == 8 || argc == 9) && !std::strcmp(argv[1], "coordinate")) {
+        Config config{0, 0, 0, 0, 0, argv[7]};
+        std::int64_t *fields[] = {
+            &config.shards, &config.passes, &config.xs, &config.ys};
+        bool parsed = true;
+        for (int i=0; i<4; ++i) {
+            char *end; *fields[i] = std::strtoll(argv[3+i], &end, 10);
+            parsed &= *argv[3+i] && !*end;
+        }
+        if (parsed && config.valid()
+                && (argc == 8 || parse_sequence(argv[8], config.sequence)))
+            return coordinate(argv[2], config);
+    }
+    if (argc == 3 && !std::strcmp(argv[1], "work"))
+        return work(argv[2]);
+    if (argc >= 4 && !std::strcmp(argv[1], "merge")) {
+        Screen screen;
+        if (!merge({argv+3, argv+argc}, screen) || !screen.to_file(argv[2])) {
+            std::fprintf(stderr, "merge failed\n");
+            return 1;
+        }
+        return 0;
+    }
+    std::fprintf(stderr, "usage: %s coordinate DIR SHARDS PASSES XS YS SCENE"
+            " [random|stratified|halton|sobol]\n"
+            "       %s work DIR\n"
+            "       %s merge OUT SHARD.ckpt...\n", argv[0], argv[0], argv[0]);
+    return 2;
+}
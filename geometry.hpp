@@ -1,6 +1,8 @@
 #pragma once
 
+#include <algorithm>
 #include <cmath>
+#include <limits>
 #include <random>
 #include <utility>
 
@@ -9,98 +11,292 @@
 #include <boost/math/constants/constants.hpp>
 #include <unsupported/Eigen/Polynomials>
 
+#include "roots.hpp"
+#include "sampler.hpp"
 
-constexpr double EPS = 1e-8;
 
-inline Eigen::Vector3d proj(const Eigen::Vector3d &v,
-        const Eigen::Vector3d &n) { return v.dot(n)/n.dot(n) * n; }
-inline Eigen::Vector3d vert(const Eigen::Vector3d &v) {
+// Scalar of the tracing core: positions, directions, distances, normals
+// and densities. -DWD_FLOAT makes it float; colours, radiance and the
+// accumulation buffers of Screen stay double either way.
+#ifdef WD_FLOAT
+using Real = float;
+#else
+using Real = double;
+#endif
+using Vector3 = Eigen::Matrix<Real, 3, 1>;
+
+// Tolerances that depend on the precision. A hit closer than EPS times the
+// largest coordinate of the ray's origin (or EPS, near the origin) is the
+// surface the ray starts from, since the rounding error of a computed hit
+// point grows with its coordinates; MATCH is the relative difference up
+// to which two distances computed along different routes, e.g. to a
+// sampled light and back, are taken to be equal.
+template<class T> struct Precision;
+template<> struct Precision<double> {
+    static constexpr double EPS = 1e-9, MATCH = 1e-6;
+};
+template<> struct Precision<float> {
+    static constexpr float EPS = 2e-5f, MATCH = 1e-4f;
+};
+constexpr Real EPS = Precision<Real>::EPS;
+inline Real epsilon(Real x, Real y, Real z) {
+    using std::abs;
+    return EPS * std::max({Real(1), abs(x), abs(y), abs(z)});
+}
+inline Real epsilon(const Vector3 &p) {
+    return epsilon(p.x(), p.y(), p.z());
+}
+// A point p just computed on a surface with unit normal n, moved off it
+// to the side that the new direction d leaves by. A computed hit point can
+// lie on either side of the surface, by more than the distance threshold
+// covers once the new ray is close to tangent.
+inline Vector3 offset(const Vector3 &p, const Vector3 &n, const Vector3 &d) {
+    return p + (d.dot(n) < 0 ? -epsilon(p) : epsilon(p)) * n;
+}
+
+inline Vector3 proj(const Vector3 &v,
+        const Vector3 &n) { return v.dot(n)/n.dot(n) * n; }
+inline double luminance(const Eigen::Vector3d &v) {
+    return .0722*v.x() + .7152*v.y() + .2126*v.z();
+}
+inline Vector3 vert(const Vector3 &v) {
     if (std::abs(v.y()) <= std::abs(v.x()))
         return {v.z(), 0., -v.x()};
     return {0., v.z(), -v.y()};
 }
 
 struct Ray {
-    Eigen::Vector3d o, d;
+    Vector3 o, d;
+};
+
+// Structure-of-arrays batch of W rays for the packet kernels. The kernels
+// loop over independent lanes under `omp simd`, so they compile to AVX2 or
+// AVX-512 when the target has them and to scalar code otherwise.
+constexpr int PACKET = 8;
+template<int W> struct RayPacket {
+    alignas(64) Real o[3][W], d[3][W];
+    void set(int i, const Ray &ray) {
+        for (int k=0; k<3; ++k) {
+            o[k][i] = ray.o[k];
+            d[k][i] = ray.d[k];
+        }
+    }
+    Ray operator[](int i) const {
+        return {{o[0][i], o[1][i], o[2][i]}, {d[0][i], d[1][i], d[2][i]}};
+    }
+};
+
+struct Aabb {
+    Vector3 lo, hi;
+    static Aabb empty() {
+        constexpr Real inf = std::numeric_limits<Real>::infinity();
+        return {{inf, inf, inf}, {-inf, -inf, -inf}};
+    }
+    void extend(const Vector3 &p) {
+        lo = lo.cwiseMin(p); hi = hi.cwiseMax(p);
+    }
+    void extend(const Aabb &box) {
+        lo = lo.cwiseMin(box.lo); hi = hi.cwiseMax(box.hi);
+    }
+    Vector3 center() const { return (lo + hi) / 2.; }
+    double area() const {
+        Eigen::Vector3d e = (hi - lo).cwiseMax(0.).cast<double>();
+        return 2. * (e.x()*e.y() + e.y()*e.z() + e.z()*e.x());
+    }
+    // Slab test against [0, t_max); d_inv is the componentwise inverse of
+    // the ray direction, infinities included.
+    bool intersects_with(const Ray &ray,
+            const Vector3 &d_inv, Real t_max) const {
+        Real t0 = 0., t1 = t_max;
+        for (int i=0; i<3; ++i) {
+            Real ta = (lo[i] - ray.o[i]) * d_inv[i];
+            Real tb = (hi[i] - ray.o[i]) * d_inv[i];
+            if (ta > tb)
+                std::swap(ta, tb);
+            t0 = ta > t0 ? ta : t0;
+            t1 = tb < t1 ? tb : t1;
+            if (t0 > t1)
+                return false;
+        }
+        return true;
+    }
+    // Packet version; lanes whose t_max is below 0. never pass, while one
+    // whose t_max is 0. still passes a box that contains its origin. The
+    // test is not strict, so that flat boxes (rectangles) are hit.
+    template<int W> bool intersects_with(const RayPacket<W> &rays,
+            const Real (&d_inv)[3][W], const Real (&t_max)[W]) const {
+        bool any = false;
+#pragma omp simd reduction(|:any)
+        for (int i=0; i<W; ++i) {
+            Real t0 = 0., t1 = t_max[i];
+            for (int k=0; k<3; ++k) {
+                Real ta = (lo[k] - rays.o[k][i]) * d_inv[k][i];
+                Real tb = (hi[k] - rays.o[k][i]) * d_inv[k][i];
+                t0 = std::max(t0, std::min(ta, tb));
+                t1 = std::min(t1, std::max(ta, tb));
+            }
+            any |= t0 <= t1;
+        }
+        return any;
+    }
 };
 
 struct RayTransformer {
-    const Eigen::Vector3d &d, &n;
-    Eigen::Vector3d diffuse_reflect(std::minstd_rand &rng) {
+    const Vector3 &d, &n;
+    // Cosine-weighted (Lambertian) direction in the hemisphere around n.
+    Vector3 diffuse_reflect(CounterRng &rng) {
         using uniform = std::uniform_real_distribution<>;
         using boost::math::constants::pi;
-        Eigen::Vector3d x = vert(n).normalized(), y = n.cross(x);
-        double theta_cosine = uniform(0., 1.)(rng);
-        double theta_sine = std::sqrt(1. - std::pow(theta_cosine, 2));
-        double phi = uniform(0., 2*pi<double>())(rng);
+        Vector3 x = vert(n).normalized(), y = n.cross(x);
+        Real r2 = uniform(0., 1.)(rng);
+        Real theta_sine = std::sqrt(r2);
+        Real theta_cosine = std::sqrt(1 - r2);
+        Real phi = uniform(0., 2*pi<double>())(rng);
         return (x*std::cos(phi)*theta_sine
             + y*std::sin(phi)*theta_sine + n*theta_cosine);
     }
-    Eigen::Vector3d specular_reflect() { return d - 2 * proj(d, n); }
-    std::pair<Eigen::Vector3d, double> refract(
-            double nr, std::minstd_rand &rng) {
-        using discrete = std::discrete_distribution<>;
-        double i_cos2 = std::pow(d.dot(n), 2) / (d.dot(d)*n.dot(n));
-        double r_cos2 = 1. - (1.-i_cos2)*nr*nr;
-        if (r_cos2 <= 0.)
-            return {specular_reflect(), 1.};
-        double R0 = std::pow((nr-1.)/(nr+1.), 2);
-        double Ki = R0 + (1.-R0)*std::pow(1.-std::sqrt(i_cos2), 5);
-        double Kr = 1. - (R0 + (1.-R0)*std::pow(1.-std::sqrt(r_cos2), 5));
-        Eigen::Vector3d d_new;
-        if (discrete({Ki, Kr})(rng) == 0)
+    // Solid-angle density of diffuse_reflect() producing w.
+    Real diffuse_pdf(const Vector3 &w) const {
+        using boost::math::constants::pi;
+        Real cosine = w.dot(n) / (w.norm()*n.norm());
+        return cosine > 0 ? cosine / pi<Real>() : 0;
+    }
+    Vector3 specular_reflect() { return d - 2 * proj(d, n); }
+    std::pair<Vector3, Real> refract(Real nr, CounterRng &rng) {
+        using uniform = std::uniform_real_distribution<>;
+        Real i_cos2 = std::pow(d.dot(n), 2) / (d.dot(d)*n.dot(n));
+        Real r_cos2 = 1 - (1-i_cos2)*nr*nr;
+        if (r_cos2 <= 0)
+            return {specular_reflect(), 1};
+        Real R0 = std::pow((nr-1)/(nr+1), 2);
+        Real Ki = R0 + (1-R0)*std::pow(1-std::sqrt(i_cos2), 5);
+        Real Kr = 1 - (R0 + (1-R0)*std::pow(1-std::sqrt(r_cos2), 5));
+        Vector3 d_new;
+        if (uniform(0., Ki+Kr)(rng) < Ki)
             d_new = specular_reflect();
         else
             d_new = (d + (d - proj(d, n)) * (
-                std::sqrt((1./r_cos2-1.)/(1./i_cos2-1.))-1.)).normalized();
+                std::sqrt((1/r_cos2-1)/(1/i_cos2-1))-1)).normalized();
         return {d_new, Ki+Kr};
     }
 };
 
 namespace shapes {
 struct Sphere {
-    Eigen::Vector3d o; double r;
-    double intersects_with(const Ray &ray) const {
-        Eigen::Vector3d rel = ray.o - this->o;
-        double qea = ray.d.dot(ray.d), qebh = ray.d.dot(rel), 
-               qec = rel.dot(rel) - r*r, det = qebh*qebh - qea*qec;
-        if (det <= 0.)
-            return 0.;
-        det = std::sqrt(det); double t;
-        return (t=-qebh-det) > EPS || (t=-qebh+det) > EPS ? t : 0.;
+    Vector3 o; Real r;
+    Real intersects_with(const Ray &ray) const {
+        Vector3 rel = ray.o - this->o;
+        Real qea = ray.d.dot(ray.d), qebh = ray.d.dot(rel),
+             qec = rel.dot(rel) - r*r, det = qebh*qebh - qea*qec;
+        if (det <= 0)
+            return 0;
+        det = std::sqrt(det); Real t, eps = epsilon(ray.o);
+        return (t=-qebh-det) > eps || (t=-qebh+det) > eps ? t : 0;
+    }
+    template<int W> void intersects_with(
+            const RayPacket<W> &rays, Real (&t)[W]) const {
+        Real ox = o.x(), oy = o.y(), oz = o.z(), r2 = r*r;
+#pragma omp simd
+        for (int i=0; i<W; ++i) {
+            Real rx = rays.o[0][i]-ox, ry = rays.o[1][i]-oy,
+                 rz = rays.o[2][i]-oz;
+            Real dx = rays.d[0][i], dy = rays.d[1][i], dz = rays.d[2][i];
+            Real qea = dx*dx + dy*dy + dz*dz, qebh = dx*rx + dy*ry + dz*rz,
+                 qec = rx*rx + ry*ry + rz*rz - r2,
+                 det = qebh*qebh - qea*qec;
+            Real sq = std::sqrt(std::max(det, Real(0)));
+            Real t0 = -qebh-sq, t1 = -qebh+sq;
+            Real eps = epsilon(rays.o[0][i], rays.o[1][i], rays.o[2][i]);
+            t[i] = det <= 0 ? 0 : t0 > eps ? t0 : t1 > eps ? t1 : 0;
+        }
     }
     bool __is_inside(const Ray &ray,
-            const Eigen::Vector3d &z) const { return ray.d.dot(z) > 0.; }
+            const Vector3 &z) const { return ray.d.dot(z) > 0; }
     bool is_inside(
             const Ray &ray) const { return __is_inside(ray, ray.o-this->o); }
-    Eigen::Vector3d normal(const Ray &ray) const {
-        Eigen::Vector3d z = ray.o - this->o;
+    Vector3 normal(const Ray &ray) const {
+        Vector3 z = ray.o - this->o;
         if (__is_inside(ray, z))
-            z *= -1.;
+            z *= -1;
         return z / r;
     }
+    Aabb bounds() const {
+        Vector3 e = Vector3::Constant(std::abs(r));
+        return {o - e, o + e};
+    }
+    Real area() const {
+        using boost::math::constants::pi;
+        return 4*pi<Real>()*r*r;
+    }
+    // Maps (u, v) in [0, 1)^2 uniformly by area onto the surface.
+    Vector3 sample(Real u, Real v) const {
+        using boost::math::constants::pi;
+        Real z = 1 - 2*u, rho = std::sqrt(std::max(1 - z*z, Real(0)));
+        Real phi = 2*pi<Real>()*v;
+        return o + r*Vector3{rho*std::cos(phi), rho*std::sin(phi), z};
+    }
 };
 
 struct DefiniteRectangle {
-    Eigen::Vector3d o, n, a, b; double am, bm;
-    double intersects_with(const Ray &ray) const {
-        Eigen::Vector3d rel = ray.o - this->o;
-        double p = ray.d.dot(this->n), q = -rel.dot(this->n), t;
-        if (std::abs(p) <= EPS || (t=q/p) <= EPS)
-            return 0.;
-        Eigen::Vector3d where = rel + t*ray.d;
-        double wa = where.dot(a), wb = where.dot(b);
-        return 0. < wa && wa < am && 0. < wb && wb < bm ? t : 0.;
+    Vector3 o, n, a, b; Real am, bm;
+    Real intersects_with(const Ray &ray) const {
+        Vector3 rel = ray.o - this->o;
+        Real p = ray.d.dot(this->n), q = -rel.dot(this->n), t;
+        if (std::abs(p) <= EPS || (t=q/p) <= epsilon(ray.o))
+            return 0;
+        Vector3 where = rel + t*ray.d;
+        Real wa = where.dot(a), wb = where.dot(b);
+        return 0 < wa && wa < am && 0 < wb && wb < bm ? t : 0;
+    }
+    template<int W> void intersects_with(
+            const RayPacket<W> &rays, Real (&t)[W]) const {
+        Real ox = o.x(), oy = o.y(), oz = o.z(),
+             nx = n.x(), ny = n.y(), nz = n.z(),
+             ax = a.x(), ay = a.y(), az = a.z(),
+             bx = b.x(), by = b.y(), bz = b.z();
+#pragma omp simd
+        for (int i=0; i<W; ++i) {
+            Real rx = rays.o[0][i]-ox, ry = rays.o[1][i]-oy,
+                 rz = rays.o[2][i]-oz;
+            Real dx = rays.d[0][i], dy = rays.d[1][i], dz = rays.d[2][i];
+            Real p = dx*nx + dy*ny + dz*nz, q = -(rx*nx + ry*ny + rz*nz);
+            Real _t = q / p;
+            Real wx = rx + _t*dx, wy = ry + _t*dy, wz = rz + _t*dz;
+            Real wa = wx*ax + wy*ay + wz*az, wb = wx*bx + wy*by + wz*bz;
+            Real eps = epsilon(rays.o[0][i], rays.o[1][i], rays.o[2][i]);
+            bool hit = std::abs(p) > EPS && _t > eps
+                && 0 < wa && wa < am && 0 < wb && wb < bm;
+            t[i] = hit ? _t : 0;
+        }
     }
-    Eigen::Vector3d normal(const Ray &ray) const {
-        return ray.d.dot(this->n) > 0. ? -this->n : this->n;
+    Vector3 normal(const Ray &ray) const {
+        return ray.d.dot(this->n) > 0 ? -this->n : this->n;
+    }
+    // Padded so that the box of an axis-aligned rectangle has some depth.
+    Aabb bounds() const {
+        Aabb box = Aabb::empty();
+        box.extend(o); box.extend(o + am*a);
+        box.extend(o + bm*b); box.extend(o + am*a + bm*b);
+        Real pad = std::max(epsilon(box.lo), epsilon(box.hi));
+        box.lo.array() -= pad; box.hi.array() += pad;
+        return box;
+    }
+    Real area() const { return am*bm; }
+    Vector3 sample(Real u, Real v) const {
+        return o + u*am*a + v*bm*b;
     }
 };
 
+// The polynomial solve is ill-conditioned (see intersects_with_reference)
+// and always runs in double: in float, Sturm isolation is hardly faster and
+// its roots are off by up to 0.3% in t even for steep rays. The float build
+// only runs the bounding test of the packet kernel in float, which rejects
+// most rays before the solve.
 struct WaterDrop {
-    Eigen::Vector3d o; double s;
+    Vector3 o; Real s;
     double __with_parallel_ray(const Ray &ray) const {
-        Eigen::Vector3d rel = ray.o - this->o;
+        Eigen::Vector3d rel = (ray.o - this->o).cast<double>();
+        double s = this->s;
         if (!((rel.y() <= 0.) ^ (rel.y() <= 6.*s)))
             return 0.;
         double u = std::sqrt(rel.y()/(6.*s));
@@ -110,61 +306,132 @@ struct WaterDrop {
                qec = rel2d.dot(rel2d) - r2, det = qebh*qebh - qea*qec;
         if (det <= 0.)
             return 0.;
-        det = std::sqrt(det); double t;
-        return (t=-qebh-det) > EPS || (t=-qebh+det) > EPS ? t : 0.;
+        det = std::sqrt(det); double t, eps = epsilon(ray.o);
+        return (t=-qebh-det) > eps || (t=-qebh+det) > eps ? t : 0.;
     }
-    double intersects_with(const Ray &ray) const {
+    Real intersects_with(const Ray &ray) const {
+        return __intersects_with<false>(ray);
+    }
+    // The bounding test runs across the packet; only surviving lanes go on
+    // to the scalar polynomial solve.
+    template<int W> void intersects_with(
+            const RayPacket<W> &rays, Real (&t)[W]) const {
+        Real ox = o.x(), oy = o.y(), oz = o.z(),
+             Y = std::pow((14*std::sqrt(Real(7))-20)*s/9, 2);
+        bool maybe[W];
+#pragma omp simd
+        for (int i=0; i<W; ++i) {
+            Real rx = rays.o[0][i]-ox, ry = rays.o[1][i]-oy,
+                 rz = rays.o[2][i]-oz;
+            Real dx = rays.d[0][i], dy = rays.d[1][i], dz = rays.d[2][i];
+            Real A = 6*s*dx/dy, B = -ry*dx/dy+rx;
+            Real C = 6*s*dz/dy, D = -ry*dz/dy+rz;
+            Real X = (A*D-B*C)*(A*D-B*C)/(A*A+C*C);
+            bool away = (dy > 0 && ry >= 0 && ry >= 6*s)
+                || (dy < 0 && ry <= 0 && ry <= 6*s);
+            // With a margin, as the scalar solve in double has the last word.
+            maybe[i] = std::abs(dy) <= EPS
+                || (!away && X < Y*(1+Precision<Real>::MATCH));
+        }
+        for (int i=0; i<W; ++i)
+            t[i] = maybe[i] ? intersects_with(rays[i]) : 0;
+    }
+    // Same as intersects_with(), but solves the polynomial with the
+    // companion-matrix eigensolver; kept as the reference for roots.hpp.
+    // For |d.y| >= 1e-3 the Sturm hit lies within 1e-8 of the drop's
+    // height from the surface and this one within 1e-7, so their t agree
+    // to about 1e-7 relative for most rays but differ by up to 2e-4 for
+    // origins near the axis. Closer to horizontal the polynomial is
+    // ill-conditioned for both.
+    Real intersects_with_reference(const Ray &ray) const {
+        return __intersects_with<true>(ray);
+    }
+    template<bool Reference> Real __intersects_with(const Ray &ray) const {
         if (std::abs(ray.d.y()) <= EPS)
             return __with_parallel_ray(ray);
-        Eigen::Vector3d rel = ray.o - this->o;
-        if (ray.d.y() > 0. && rel.y() >= 0. && rel.y() >= 6.*s)
+        Eigen::Vector3d rel = ray.o.cast<double>() - o.cast<double>(),
+            d = ray.d.cast<double>();
+        double s = this->s;
+        if (d.y() > 0. && rel.y() >= 0. && rel.y() >= 6.*s)
             return 0.;
-        if (ray.d.y() < 0. && rel.y() <= 0. && rel.y() <= 6.*s)
+        if (d.y() < 0. && rel.y() <= 0. && rel.y() <= 6.*s)
             return 0.;
-        double A = 6.*s*ray.d.x()/ray.d.y();
-        double B = -rel.y()*ray.d.x()/ray.d.y()+rel.x();
-        double C = 6.*s*ray.d.z()/ray.d.y();
-        double D = -rel.y()*ray.d.z()/ray.d.y()+rel.z();
+        double A = 6.*s*d.x()/d.y();
+        double B = -rel.y()*d.x()/d.y()+rel.x();
+        double C = 6.*s*d.z()/d.y();
+        double D = -rel.y()*d.z()/d.y()+rel.z();
         double X = std::pow(A*D-B*C, 2)/(A*A+C*C);
         double Y = std::pow((14*std::sqrt(7)-20)*s/9, 2);
         if (X >= Y)
             return 0.;
-        Eigen::Matrix<double, 7, 1> poly;
-        poly << -B*B-D*D, 0., 36.*s*s-2*A*B-2*C*D, -36.*s*s,
-                -27.*s*s-A*A-C*C, 18.*s*s, 9.*s*s;
-        Eigen::PolynomialSolver<double, 6> ps; ps.compute(poly);
+        double poly[7] = {-B*B-D*D, 0., 36.*s*s-2*A*B-2*C*D, -36.*s*s,
+                -27.*s*s-A*A-C*C, 18.*s*s, 9.*s*s};
+        double eps = epsilon(ray.o);
+        if (Reference)
+            return __with_eigen(poly, rel, d, eps);
+        return __with_sturm(poly, rel, d, eps);
+    }
+    // t = (6su^2-rel.y)/d.y is monotonic in u on (0, 1), so the nearest hit
+    // is the first root, from the side where t grows, that clears eps.
+    double __with_sturm(const double (&poly)[7], const Eigen::Vector3d &rel,
+            const Eigen::Vector3d &d, double eps) const {
+        double k = s / d.y(), q = (rel.y()+eps*d.y()) / (6.*s);
+        double lo = 0., hi = 1., u;
+        if (k > 0.)
+            lo = std::sqrt(std::max(q, 0.));
+        else if (q <= 0.)
+            return 0.;
+        else
+            hi = std::min(std::sqrt(q), 1.);
+        if (!SturmSequence<6>(poly).first_root(lo, hi, k < 0., u)
+                || u <= 0. || u >= 1.)
+            return 0.;
+        double t = (6.*s*u*u-rel.y()) / d.y();
+        return t > eps ? t : 0.;
+    }
+    double __with_eigen(const double (&poly)[7], const Eigen::Vector3d &rel,
+            const Eigen::Vector3d &d, double eps) const {
+        Eigen::PolynomialSolver<double, 6> ps;
+        ps.compute(Eigen::Map<const Eigen::Matrix<double, 7, 1>>(poly));
         std::vector<double> u_roots; ps.realRoots(u_roots);
         double t = 0.; bool t_found = false;
         for (auto u : u_roots) {
             if (u <= 0. || u >= 1.)
                 continue;
-            double _t = (6.*s*u*u-rel.y()) / ray.d.y();
-            if (_t > EPS && (!t_found || _t < t)) {
+            double _t = (6.*s*u*u-rel.y()) / d.y();
+            if (_t > eps && (!t_found || _t < t)) {
                 t_found = true;
                 t = _t;
             }
         }
         return t;
     }
-    Eigen::Vector3d __z(const Ray &ray) const {
-        Eigen::Vector3d rel = ray.o - this->o;
-        double u = std::sqrt(rel.y()/(6.*s));
-        Eigen::Vector3d x_d_{rel.x(), 0., rel.z()}; x_d_.normalize();
-        if (s < 0.)
+    Vector3 __z(const Ray &ray) const {
+        Vector3 rel = ray.o - this->o;
+        Real u = std::sqrt(rel.y()/(6*s));
+        Vector3 x_d_{rel.x(), 0., rel.z()}; x_d_.normalize();
+        if (s < 0)
             x_d_ *= -1;
-        double dx = 12.*u*s, dy = (9.*u*u+6.*u-6.)*s;
-        return dx*x_d_ + dy*Eigen::Vector3d{0., 1., 0.};
+        Real dx = 12*u*s, dy = (9*u*u+6*u-6)*s;
+        return dx*x_d_ + dy*Vector3{0., 1., 0.};
     }
     bool __is_inside(const Ray &ray,
-            const Eigen::Vector3d &z) const { return ray.d.dot(z) > 0.; }
+            const Vector3 &z) const { return ray.d.dot(z) > 0; }
     bool is_inside(
             const Ray &ray) const { return __is_inside(ray, __z(ray)); }
-    Eigen::Vector3d normal(const Ray &ray) const {
-        Eigen::Vector3d z = __z(ray);
+    Vector3 normal(const Ray &ray) const {
+        Vector3 z = __z(ray);
         if (__is_inside(ray, z))
-            z *= -1.;
+            z *= -1;
         return z.normalized();
     }
+    // The radius 3|s|u(1-u)(2+u) peaks at (14*sqrt(7)-20)|s|/9, the same
+    // bound intersects_with() tests against; see wd_math.pdf.
+    Aabb bounds() const {
+        Real r = (14*std::sqrt(Real(7))-20)*std::abs(s)/9;
+        Real y0 = std::min(Real(0), 6*s), y1 = std::max(Real(0), 6*s);
+        return {o + Vector3{-r, y0, -r}, o + Vector3{r, y1, r}};
+    }
 };
 
 }
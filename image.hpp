@@ -0,0 +1,221 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "objects.hpp"
+
+
+// Radiance is stored in OpenCV's BGR channel order (textures come from
+// cv2.imread); the writers below reorder to RGB.
+enum class ToneMap { clamp, reinhard, aces };
+
+// clamp with exposure 1. and no sRGB curve reproduces data2png.py.
+struct ToneMapping {
+    ToneMap op = ToneMap::clamp; double exposure = 1.; bool srgb = false;
+    double __map(double v) const {
+        v = std::max(v * exposure, 0.);
+        switch (op) {
+        case ToneMap::clamp:
+            break;
+        case ToneMap::reinhard:
+            v = v / (1. + v);
+            break;
+        case ToneMap::aces:  // Narkowicz's fit of the ACES filmic curve
+            v = v*(2.51*v + .03) / (v*(2.43*v + .59) + .14);
+            break;
+        }
+        v = std::min(v, 1.);
+        if (srgb)
+            v = v <= .0031308 ? 12.92*v : 1.055*std::pow(v, 1/2.4) - .055;
+        return v;
+    }
+    std::array<std::uint8_t, 3> operator()(const Eigen::Vector3d &bgr) const {
+        return {std::uint8_t(__map(bgr.z())*255), std::uint8_t(
+                __map(bgr.y())*255), std::uint8_t(__map(bgr.x())*255)};
+    }
+};
+
+// Mean radiance of every pixel, row-major from the top.
+inline std::vector<Eigen::Vector3d> radiance(const Screen &screen) {
+    std::vector<Eigen::Vector3d> pixels(screen.xs*screen.ys);
+    for (std::int64_t y=0; y<screen.ys; ++y)
+        for (std::int64_t x=0; x<screen.xs; ++x) {
+            std::int64_t n = screen.__samples(x, y);
+            pixels[y*screen.xs+x] = n ? (screen.data[screen.index(x, y)]
+                / double(n)).eval() : Eigen::Vector3d{0., 0., 0.};
+        }
+    return pixels;
+}
+
+// Little-endian PFM, rows stored bottom to top as the format requires.
+inline bool write_pfm(const char *filename, std::int64_t xs, std::int64_t ys,
+        const std::vector<Eigen::Vector3d> &pixels) {
+    std::FILE *file = std::fopen(filename, "wb");
+    if (!file)
+        return false;
+    std::fprintf(file, "PF\n%lld %lld\n-1.0\n",
+            (long long) xs, (long long) ys);
+    std::vector<float> row(xs*3);
+    for (std::int64_t y=ys-1; y>=0; --y) {
+        for (std::int64_t x=0; x<xs; ++x)
+            for (int c=0; c<3; ++c)
+                row[x*3+c] = pixels[y*xs+x][2-c];
+        std::fwrite(row.data(), 4, row.size(), file);
+    }
+    return std::fclose(file) == 0;
+}
+
+// 8-bit RGB PNG. The image data is zlib-wrapped in stored (uncompressed)
+// deflate blocks, which needs no compression library.
+inline bool write_png(const char *filename, std::int64_t xs, std::int64_t ys,
+        const std::vector<Eigen::Vector3d> &pixels, const ToneMapping &tone) {
+    static const auto crc_table = [] {
+        std::array<std::uint32_t, 256> table;
+        for (std::uint32_t n=0; n<256; ++n) {
+            std::uint32_t c = n;
+            for (int k=0; k<8; ++k)
+                c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            table[n] = c;
+        }
+        return table;
+    }();
+    std::vector<std::uint8_t> raw;
+    raw.reserve(ys * (1 + xs*3));
+    for (std::int64_t y=0; y<ys; ++y) {
+        raw.push_back(0);
+        for (std::int64_t x=0; x<xs; ++x)
+            for (auto v : tone(pixels[y*xs+x]))
+                raw.push_back(v);
+    }
+    std::vector<std::uint8_t> z{0x78, 0x01};
+    std::uint32_t a = 1, b = 0;
+    for (std::size_t i=0; i<raw.size() || i==0; i+=65535) {
+        std::size_t n = std::min<std::size_t>(65535, raw.size() - i);
+        z.push_back(i + n == raw.size());
+        z.push_back(n & 0xff); z.push_back(n >> 8);
+        z.push_back(~n & 0xff); z.push_back((~n >> 8) & 0xff);
+        z.insert(z.end(), raw.begin()+i, raw.begin()+i+n);
+    }
+    for (auto v : raw) {
+        a = (a + v) % 65521; b = (b + a) % 65521;
+    }
+    for (int s=24; s>=0; s-=8)
+        z.push_back(((b << 16 | a) >> s) & 0xff);
+    std::FILE *file = std::fopen(filename, "wb");
+    if (!file)
+        return false;
+    auto chunk = [&](const char *type, const std::vector<std::uint8_t> &d) {
+        std::uint8_t head[8] = {std::uint8_t(d.size() >> 24),
+            std::uint8_t(d.size() >> 16), std::uint8_t(d.size() >> 8),
+            std::uint8_t(d.size())};
+        std::copy(type, type+4, head+4);
+        std::uint32_t crc = 0xffffffffu;
+        auto update = [&](std::uint8_t v) {
+            crc = crc_table[(crc ^ v) & 0xff] ^ (crc >> 8);
+        };
+        std::for_each(head+4, head+8, update);
+        std::for_each(d.begin(), d.end(), update);
+        crc ^= 0xffffffffu;
+        std::uint8_t tail[4] = {std::uint8_t(crc >> 24), std::uint8_t(
+                crc >> 16), std::uint8_t(crc >> 8), std::uint8_t(crc)};
+        std::fwrite(head, 1, 8, file);
+        std::fwrite(d.data(), 1, d.size(), file);
+        std::fwrite(tail, 1, 4, file);
+    };
+    const std::uint8_t signature[8] = {
+        137, 'P', 'N', 'G', '\r', '\n', 26, '\n'};
+    std::fwrite(signature, 1, 8, file);
+    std::vector<std::uint8_t> header(13, 0);
+    for (int s=0; s<4; ++s) {
+        header[s] = (xs >> (24 - 8*s)) & 0xff;
+        header[4+s] = (ys >> (24 - 8*s)) & 0xff;
+    }
+    header[8] = 8; header[9] = 2;
+    chunk("IHDR", header); chunk("IDAT", z); chunk("IEND", {});
+    return std::fclose(file) == 0;
+}
+
+// A downsampled copy of a Screen, one pixel per SCALE by SCALE block, that a
+// background thread writes as a PNG every `interval`. Render threads refresh
+// a tile's blocks when they finish that tile (Screen::tile_done), holding
+// the lock only for that tile's few preview pixels; the writer copies the
+// small preview under the lock and encodes it outside.
+struct Preview {
+    static constexpr std::int64_t SCALE = 4;
+    static_assert(Screen::TILE % SCALE == 0);
+    std::int64_t xs = 0, ys = 0; std::vector<Eigen::Vector3d> pixels;
+    std::mutex mutex; std::condition_variable wake; bool stopping = false;
+    std::thread writer; Screen *target = nullptr;
+
+    void update(const Screen &screen, std::int64_t k) {
+        std::int64_t x0 = k%screen.xt*Screen::TILE;
+        std::int64_t y0 = k/screen.xt*Screen::TILE;
+        std::int64_t x1 = std::min(x0+Screen::TILE, screen.xs);
+        std::int64_t y1 = std::min(y0+Screen::TILE, screen.ys);
+        double n = std::max<std::int64_t>(screen.samples[k], 1);
+        Eigen::Vector3d block[Screen::TILE/SCALE][Screen::TILE/SCALE];
+        for (auto &row : block)
+            for (auto &v : row)
+                v.setZero();
+        for (std::int64_t y=y0; y<y1; ++y)
+            for (std::int64_t x=x0; x<x1; ++x)
+                block[(y-y0)/SCALE][(x-x0)/SCALE]
+                    += screen.data[screen.index(x, y)];
+        std::lock_guard<std::mutex> lock(mutex);
+        for (std::int64_t y=y0/SCALE; y<(y1+SCALE-1)/SCALE; ++y)
+            for (std::int64_t x=x0/SCALE; x<(x1+SCALE-1)/SCALE; ++x) {
+                std::int64_t w = (std::min((x+1)*SCALE, x1) - x*SCALE)
+                    * (std::min((y+1)*SCALE, y1) - y*SCALE);
+                pixels[y*xs+x] = block[y-y0/SCALE][x-x0/SCALE] / (n*w);
+            }
+    }
+    // Hooks into the screen and starts writing `filename`; the screen must
+    // not be resized until stop().
+    void start(Screen &screen, std::string filename,
+            std::chrono::duration<double> interval, ToneMapping tone) {
+        stop();
+        target = &screen;
+        xs = (screen.xs+SCALE-1) / SCALE; ys = (screen.ys+SCALE-1) / SCALE;
+        pixels.assign(xs*ys, {0., 0., 0.});
+        for (std::int64_t k=0; k<screen.xt*screen.yt; ++k)
+            update(screen, k);
+        screen.tile_done = [this](const Screen &s, std::int64_t k) {
+            update(s, k);
+        };
+        stopping = false;
+        writer = std::thread([this, filename, interval, tone] {
+            std::string tmp = filename + ".tmp";
+            std::vector<Eigen::Vector3d> copy;
+            std::unique_lock<std::mutex> lock(mutex);
+            while (!wake.wait_for(lock, interval, [&] { return stopping; })) {
+                copy = pixels;
+                lock.unlock();
+                if (write_png(tmp.c_str(), xs, ys, copy, tone))
+                    std::rename(tmp.c_str(), filename.c_str());
+                lock.lock();
+            }
+        });
+    }
+    void stop() {
+        if (!writer.joinable())
+            return;
+        target->tile_done = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        writer.join();
+    }
+    ~Preview() { stop(); }
+};
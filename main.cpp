@@ -1,7 +1,18 @@
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <ctime>
+#include <iterator>
 #include <limits>
 
-#include "scenes.hpp"
+#include "checkpoint.hpp"
+#include "denoise.hpp"
+#include "image.hpp"
+#include "scenefile.hpp"
+#include "sppm.hpp"
 
 
 bool should_stop() {
@@ -13,14 +24,187 @@ bool should_stop() {
     return stop;
 }
 
-int main() {
-    std::minstd_rand rng{static_cast<uint_fast32_t>(std::time(nullptr))};
-    auto scene = scenes::threebody::scene(rng);
-    auto camera = scenes::threebody::camera(rng, scene);
-    Screen screen;
-    if (!screen.from_file("out/scene.dat"))
-        screen.initialize_data(1600, 1200);
-    for (std::size_t i=0; !(i%16==0&&should_stop()); ++i)
-        screen.capture(camera);
+volatile std::sig_atomic_t interrupted = 0;
+void interrupt(int) { interrupted = 1; }
+
+// Runs from before checkpoints resumed from out/scene.dat, which is still
+// written at exit. Without a checkpoint it is resumed from as it used to
+// be, rather than overwritten by a fresh image; false if its resolution
+// differs, so that it is left alone.
+bool resume_legacy(Screen &screen) {
+    Screen legacy;
+    if (!legacy.from_file("out/scene.dat"))
+        return true;
+    if (legacy.xs != screen.xs || legacy.ys != screen.ys) {
+        std::fprintf(stderr, "out/scene.dat: resolution differs and there "
+                "is no checkpoint; move it away to start afresh\n");
+        return false;
+    }
+    bool features = !screen.albedo.empty();
+    legacy.interrupt = screen.interrupt;
+    screen = std::move(legacy);
+    if (features)
+        screen.record_features();
+    std::fprintf(stderr, "out/scene.dat: resumed at %lld passes\n",
+            (long long) screen.count);
+    return true;
+}
+
+constexpr double TARGET_ERROR = .01;
+constexpr std::int64_t PASSES = 16;
+constexpr auto CHECKPOINT_INTERVAL = std::chrono::minutes(10);
+constexpr auto PREVIEW_INTERVAL = std::chrono::seconds(30);
+constexpr auto TELEMETRY_INTERVAL = std::chrono::minutes(1);
+constexpr ToneMapping TONE{ToneMap::aces, 1., true};
+
+// Command line; size 0 by 0 keeps the scene's own resolution, spp 0
+// renders until every tile reaches TARGET_ERROR and threads 0 leaves
+// OpenMP's default. INTEGRATORS lists the names of Integrator's values
+// and then sppm, which renders with the PhotonMapper instead. --sequence
+// names one of SEQUENCES; a resumed checkpoint keeps its own. --denoise
+// needs the first-hit features, which only the packet integrators record.
+struct Options {
+    static constexpr const char *INTEGRATORS[] = {
+        "recursive", "wavefront", "nee", "sppm"};
+    const char *scene = "scenes/threebody.scene";
+    long long xs = 0, ys = 0, spp = 0; int threads = 0;
+    Integrator integrator = Integrator::recursive; bool sppm = false;
+    Sequence sequence = Sequence::random; bool denoise = false;
+    bool parse(int argc, char **argv) {
+        for (int i=1; i<argc; ++i) {
+            if (!std::strcmp(argv[i], "--denoise")) {
+                denoise = true;
+                continue;
+            }
+            if (i+1 == argc)
+                return false;
+            const char *value = argv[++i]; char *end;
+            if (!std::strcmp(argv[i-1], "--scene")) {
+                scene = value;
+                continue;
+            }
+            if (!std::strcmp(argv[i-1], "--integrator")) {
+                auto *first = std::begin(INTEGRATORS);
+                auto *last = std::end(INTEGRATORS);
+                auto *it = std::find_if(first, last, [&](const char *name) {
+                    return !std::strcmp(name, value);
+                });
+                if (it == last)
+                    return false;
+                sppm = it - first == 3;
+                if (!sppm)
+                    integrator = Integrator(it - first);
+                continue;
+            }
+            if (!std::strcmp(argv[i-1], "--sequence")) {
+                if (!parse_sequence(value, sequence))
+                    return false;
+                continue;
+            }
+            if (!std::strcmp(argv[i-1], "--size")) {
+                if (std::sscanf(value, "%lldx%lld", &xs, &ys) != 2
+                        || xs <= 0 || ys <= 0)
+                    return false;
+                continue;
+            }
+            long long n = std::strtoll(value, &end, 10);
+            if (*end || n < 0)
+                return false;
+            if (!std::strcmp(argv[i-1], "--spp"))
+                spp = n;
+            else if (!std::strcmp(argv[i-1], "--threads"))
+                threads = n;
+            else
+                return false;
+        }
+        return !denoise
+            || (!sppm && integrator != Integrator::wavefront);
+    }
+};
+
+int main(int argc, char **argv) {
+    Options options;
+    if (!options.parse(argc, argv)) {
+        std::fprintf(stderr, "usage: %s [--scene FILE] [--size XSxYS] "
+                "[--spp SAMPLES] [--threads N]\n"
+                "    [--integrator recursive|wavefront|nee|sppm]\n"
+                "    [--sequence random|stratified|halton|sobol]"
+                " [--denoise]\n", argv[0]);
+        return 2;
+    }
+    if (options.threads > 0) {
+#ifdef _OPENMP
+        omp_set_num_threads(options.threads);
+#else
+        std::fprintf(stderr, "built without OpenMP, --threads ignored\n");
+#endif
+    }
+    auto seed = static_cast<std::uint64_t>(std::time(nullptr));
+    SceneFile file;
+    if (!file.load(options.scene))
+        return 1;
+    if (options.xs)
+        file.resize(options.xs, options.ys);
+    auto &scene = file.scene; auto &camera = file.camera;
+    std::signal(SIGINT, interrupt);
+    std::signal(SIGTERM, interrupt);
+    Checkpoint checkpoint{"out/scene.ckpt", scene_hash(camera)};
+    Screen screen; screen.interrupt = &interrupted;
+    screen.initialize_data(file.xs, file.ys);
+    screen.sequence = options.sequence;
+    if (options.denoise)
+        screen.record_features();
+    if (!checkpoint.load(screen, file.xs, file.ys)) {
+        if (checkpoint.rejected) {
+            std::fprintf(stderr, "%s: move it away to start afresh\n",
+                    checkpoint.path.c_str());
+            return 1;
+        }
+        if (!resume_legacy(screen))
+            return 1;
+    }
+    if (screen.sequence != options.sequence)
+        std::fprintf(stderr, "resumed with the %s sequence, --sequence "
+                "ignored\n", SEQUENCES[int(screen.sequence)]);
+    PhotonMapper mapper; mapper.camera = &camera;
+    Preview preview;
+    preview.start(screen, "out/preview.png", PREVIEW_INTERVAL, TONE);
+    auto last = std::chrono::steady_clock::now(), last_report = last;
+    telemetry::Snapshot reported{};
+    while (!interrupted && !should_stop()
+            && (options.spp ? screen.count < options.spp
+                : !screen.converge(TARGET_ERROR))) {
+        std::int64_t passes = options.spp
+            ? std::min<std::int64_t>(PASSES, options.spp - screen.count)
+            : PASSES;
+        if (options.sppm)
+            mapper.capture(screen, seed, passes);
+        else
+            screen.capture(camera, seed, passes, options.integrator);
+        auto now = std::chrono::steady_clock::now();
+        if (now - last > CHECKPOINT_INTERVAL) {
+            checkpoint.save_async(screen);
+            last = now;
+        }
+        if (TELEMETRY && now - last_report > TELEMETRY_INTERVAL) {
+            auto counts = telemetry::collect();
+            telemetry::report(stderr, telemetry::Snapshot(counts) -= reported,
+                    std::chrono::duration<double>(now - last_report).count(),
+                    scene);
+            reported = counts; last_report = now;
+        }
+    }
+    preview.stop();
+    if (!checkpoint.save(screen))
+        std::perror("out/scene.ckpt");
     screen.to_file("out/scene.dat");
+    auto pixels = radiance(screen);
+    write_pfm("out/scene.pfm", screen.xs, screen.ys, pixels);
+    write_png("out/scene.png", screen.xs, screen.ys, pixels, TONE);
+    if (options.denoise) {
+        pixels = Denoiser()(screen);
+        write_pfm("out/scene_denoised.pfm", screen.xs, screen.ys, pixels);
+        write_png("out/scene_denoised.png", screen.xs, screen.ys, pixels,
+                TONE);
+    }
 }
@@ -1,161 +1,717 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <csignal>
+#include <functional>
 #include <memory>
+#include <tuple>
+#include <type_traits>
+#include <typeinfo>
 #include <vector>
 
+#include "bvh.hpp"
 #include "geometry.hpp"
+#include "scheduler.hpp"
+#include "telemetry.hpp"
+#include "texture.hpp"
 
 
+// Cumulative probabilities of N events, normalized once when the scene is
+// built; sampling is one uniform draw and at most N-1 compares.
+template<int N> struct EventTable {
+    std::array<double, N> cdf;
+    void build(const std::array<double, N> &prop) {
+        double sum = 0.;
+        for (auto p : prop)
+            sum += p;
+        double acc = 0.;
+        for (int i=0; i<N; ++i)
+            cdf[i] = sum > 0. ? (acc += prop[i]) / sum : 1.;
+    }
+    int sample(CounterRng &rng) const {
+        double u = std::uniform_real_distribution<>(0., 1.)(rng); int i = 0;
+        while (i < N-1 && u >= cdf[i])
+            ++i;
+        return i;
+    }
+};
+
+enum class Material { opaque, transparent, led };
+enum class Integrator { recursive, wavefront, nee };
+struct LEDOpaqueBase;
+
+// What a surface interaction sampled, beyond the continuation ray: whether
+// it was a diffuse bounce and, if so, the normal on the incoming side and
+// the solid-angle density of the new direction.
+struct Bounce {
+    bool diffuse; Vector3 n; Real pdf;
+};
+
+// First-hit attributes of a camera ray that guide the denoiser; all zero
+// when the ray escapes.
+struct Feature {
+    Eigen::Vector3d albedo, normal; double depth;
+};
+
+// Shapes that can be sampled by area, and so can act as explicit lights.
+template<class T, class = void> struct is_samplable : std::false_type {};
+template<class T> struct is_samplable<T, std::void_t<
+        decltype(std::declval<const T &>().sample(Real(0), Real(0)))>>
+    : std::true_type {};
+
 struct Object {
     virtual ~Object() = default;
-    virtual double intersects_with(const Ray &ray) = 0;
-    virtual bool transmit(Eigen::Vector3d &radiation,
-            Eigen::Vector3d &color, Ray &ray_new) = 0;
+    virtual Real intersects_with(const Ray &ray) = 0;
+    virtual void intersects_with(
+            const RayPacket<PACKET> &rays, Real (&t)[PACKET]) = 0;
+    virtual Aabb bounds() = 0;
+    virtual Material material() = 0;
+    // Whether some hits scatter diffusely, i.e. photons are stored here.
+    virtual bool diffuse() = 0;
+    // Surface normal at a point, facing away from the ray's direction.
+    virtual Vector3 normal(const Ray &ray) = 0;
+    // Surface colour plus emission at a point, only used to find edges.
+    virtual Eigen::Vector3d albedo(const Vector3 &p) = 0;
+    virtual void prepare() = 0;
+    virtual bool transmit(Eigen::Vector3d &radiation, Eigen::Vector3d &color,
+            Ray &ray_new, CounterRng &rng, Bounce &bounce) = 0;
+    // Emitted power (luminance times area) if the object can be sampled as
+    // a light, otherwise 0.
+    virtual double power() = 0;
+    virtual double area() = 0;
+    virtual Vector3 sample_surface(Real u, Real v) = 0;
+    virtual Eigen::Vector3d emission(const Vector3 &p) = 0;
+    // Solid-angle density with which Scene::direct() picks the point t
+    // along the (unit) ray; set up by Scene::build() through emitter_pdf,
+    // the area density of sampling this object.
+    virtual Real light_pdf(const Ray &ray, Real t) = 0;
+    double emitter_pdf = 0.;
+    // Feeds the material's parameters to `add`, for scene_hash(); the
+    // geometry is covered by bounds().
+    virtual void parameters(const std::function<void(double)> &add) = 0;
+    // Position in the scene after Scene::build(); keys telemetry counters.
+    std::size_t id = 0;
 };
 
 template<class OpaqueBase> struct OpaqueObject : Object {
-    OpaqueBase base; std::minstd_rand *rng;
-    void diffuse_reflect(Ray &ray_new) {
-        auto rt = RayTransformer{ray_new.d, base.normal(ray_new)};
-        ray_new.d = rt.diffuse_reflect(*rng);
+    OpaqueBase base; EventTable<3> events;
+    void prepare() final { events.build(base._prop); }
+    Material material() final {
+        return std::is_base_of<LEDOpaqueBase, OpaqueBase>::value
+            ? Material::led : Material::opaque;
+    }
+    void diffuse_reflect(Ray &ray_new, CounterRng &rng, Bounce &bounce) {
+        bounce.n = base.normal(ray_new);
+        auto rt = RayTransformer{ray_new.d, bounce.n};
+        rng.seek(CounterRng::DIRECTION);
+        ray_new.d = rt.diffuse_reflect(rng);
+        ray_new.o = offset(ray_new.o, bounce.n, ray_new.d);
+        bounce.diffuse = true; bounce.pdf = rt.diffuse_pdf(ray_new.d);
     }
     void specular_reflect(Ray &ray_new) {
-        auto rt = RayTransformer{ray_new.d, base.normal(ray_new)};
-        ray_new.d = rt.specular_reflect();
-    }
-    double intersects_with(
-            const Ray &ray) final { return base.intersects_with(ray); }
-    bool transmit(Eigen::Vector3d &radiation,
-            Eigen::Vector3d &color, Ray &ray_new) final {
-        using discrete = std::discrete_distribution<>;
-        radiation = base.radiation(ray_new.o);
-        std::array<double, 3> prop = base.prop(ray_new.o);
-        int mode = discrete(prop.begin(), prop.end())(*rng);
+        Vector3 n = base.normal(ray_new);
+        ray_new.d = RayTransformer{ray_new.d, n}.specular_reflect();
+        ray_new.o = offset(ray_new.o, n, ray_new.d);
+    }
+    Real intersects_with(const Ray &ray) final {
+        Real t = base.intersects_with(ray);
+        telemetry::test(id, t);
+        return t;
+    }
+    void intersects_with(const RayPacket<PACKET> &rays,
+            Real (&t)[PACKET]) final {
+        base.intersects_with(rays, t);
+        telemetry::test(id, t);
+    }
+    Aabb bounds() final { return base.bounds(); }
+    bool transmit(Eigen::Vector3d &radiation, Eigen::Vector3d &color,
+            Ray &ray_new, CounterRng &rng, Bounce &bounce) final {
+        radiation = base.radiation(ray_new.o); bounce.diffuse = false;
+        int mode = events.sample(rng);
         if (mode == 0)
             return false;
-        color = base.color(ray_new.o) / (1.-prop[0]);
+        color = base.color(ray_new.o) / (1.-events.cdf[0]);
         if (mode == 1)
-            diffuse_reflect(ray_new);
+            diffuse_reflect(ray_new, rng, bounce);
         else
             specular_reflect(ray_new);
         return true;
     }
+    // Estimated from the radiation on a 16x16 grid of the surface.
+    double power() final {
+        if constexpr (is_samplable<OpaqueBase>::value) {
+            double sum = 0.;
+            for (int i=0; i<16; ++i)
+                for (int j=0; j<16; ++j)
+                    sum += luminance(base.radiation(
+                        base.sample((i+.5)/16, (j+.5)/16)));
+            return sum / 256 * base.area();
+        } else
+            return 0.;
+    }
+    double area() final {
+        if constexpr (is_samplable<OpaqueBase>::value)
+            return base.area();
+        else
+            return 0.;
+    }
+    Vector3 sample_surface(Real u, Real v) final {
+        if constexpr (is_samplable<OpaqueBase>::value)
+            return base.sample(u, v);
+        else
+            return base.o;
+    }
+    Eigen::Vector3d emission(const Vector3 &p) final {
+        return base.radiation(p);
+    }
+    bool diffuse() final { return events.cdf[1] > events.cdf[0]; }
+    Vector3 normal(const Ray &ray) final { return base.normal(ray); }
+    Eigen::Vector3d albedo(const Vector3 &p) final {
+        return base.color(p) + base.radiation(p);
+    }
+    void parameters(const std::function<void(double)> &add) final {
+        base.parameters(add);
+    }
+    Real light_pdf(const Ray &ray, Real t) final {
+        if (emitter_pdf == 0.)
+            return 0;
+        Real cosine = std::abs(base.normal(ray).dot(ray.d));
+        return cosine > 0 ? emitter_pdf*t*t / cosine : 0;
+    }
 };
 
 template<class TransparentBase> struct TransparentObject : Object {
-    TransparentBase base; std::minstd_rand *rng;
+    TransparentBase base;
     std::array<double, 2> prop; Eigen::Vector3d color; double refract_index;
-    void refract(Ray &ray_new, Eigen::Vector3d &color_) {
-        double nr = refract_index;
+    EventTable<2> events;
+    Material material() final { return Material::transparent; }
+    void prepare() final { events.build(prop); }
+    void refract(
+            Ray &ray_new, Eigen::Vector3d &color_, CounterRng &rng) {
+        Real nr = refract_index;
         if (!base.is_inside(ray_new))
-            nr = 1. / nr;
-        auto rt = RayTransformer{ray_new.d, base.normal(ray_new)};
-        auto result = rt.refract(nr, *rng);
-        ray_new.d = result.first; color_ *= result.second;
-    }
-    double intersects_with(
-            const Ray &ray) final { return base.intersects_with(ray); }
-    bool transmit(Eigen::Vector3d &radiation,
-            Eigen::Vector3d &color_, Ray &ray_new) final {
-        using discrete = std::discrete_distribution<>;
-        radiation.fill(0.);
-        int mode = discrete(prop.begin(), prop.end())(*rng);
+            nr = 1 / nr;
+        Vector3 n = base.normal(ray_new);
+        auto result = RayTransformer{ray_new.d, n}.refract(nr, rng);
+        ray_new.d = result.first; color_ *= double(result.second);
+        ray_new.o = offset(ray_new.o, n, ray_new.d);
+    }
+    Real intersects_with(const Ray &ray) final {
+        Real t = base.intersects_with(ray);
+        telemetry::test(id, t);
+        return t;
+    }
+    void intersects_with(const RayPacket<PACKET> &rays,
+            Real (&t)[PACKET]) final {
+        base.intersects_with(rays, t);
+        telemetry::test(id, t);
+    }
+    Aabb bounds() final { return base.bounds(); }
+    bool transmit(Eigen::Vector3d &radiation, Eigen::Vector3d &color_,
+            Ray &ray_new, CounterRng &rng, Bounce &bounce) final {
+        radiation.fill(0.); bounce.diffuse = false;
+        int mode = events.sample(rng);
         if (mode == 0)
             return false;
-        color_ = this->color / (1.-prop[0]);
-        refract(ray_new, color_);
+        color_ = this->color / (1.-events.cdf[0]);
+        refract(ray_new, color_, rng);
         return true;
     }
+    double power() final { return 0.; }
+    double area() final { return 0.; }
+    Vector3 sample_surface(Real u, Real v) final {
+        (void) u; (void) v; return base.o;
+    }
+    Eigen::Vector3d emission(const Vector3 &p) final {
+        (void) p; return {0., 0., 0.};
+    }
+    Real light_pdf(const Ray &ray, Real t) final {
+        (void) ray; (void) t; return 0;
+    }
+    bool diffuse() final { return false; }
+    Vector3 normal(const Ray &ray) final { return base.normal(ray); }
+    Eigen::Vector3d albedo(const Vector3 &p) final {
+        (void) p; return color;
+    }
+    void parameters(const std::function<void(double)> &add) final {
+        for (double v : prop)
+            add(v);
+        add(color.x()); add(color.y()); add(color.z()); add(refract_index);
+    }
 };
 
 struct SolidColorOpaqueBase {
     std::array<double, 3> _prop;
     Eigen::Vector3d _color, _radiation;
-    auto prop(const Eigen::Vector3d &p) { (void) p; return _prop; }
-    auto color(const Eigen::Vector3d &p) { (void) p; return _color; }
-    auto radiation(const Eigen::Vector3d &p) { (void) p; return _radiation; }
+    auto color(const Vector3 &p) { (void) p; return _color; }
+    auto radiation(const Vector3 &p) { (void) p; return _radiation; }
+    void parameters(const std::function<void(double)> &add) const {
+        for (double v : _prop)
+            add(v);
+        for (int i=0; i<3; ++i) {
+            add(_color[i]); add(_radiation[i]);
+        }
+    }
 };
 
+// A rectangle showing a texture of `d` by `d` texels, read at mip level
+// `lod`; raise it when the texture is much finer than the pixels it lands
+// on, e.g. for a low-resolution preview.
 struct LEDOpaqueBase : shapes::DefiniteRectangle {
     std::array<double, 3> _prop;
-    std::vector<Eigen::Vector3d> data;
-    std::int64_t xs, ys; double d;
-    void from_file(const char *filename) {
-        std::FILE *file = std::fopen(filename, "rb");
-        std::fread(&xs, 8, 1, file);
-        std::fread(&ys, 8, 1, file);
-        data.resize(xs*ys);
-        std::fread(data.data(), sizeof(Eigen::Vector3d), xs*ys, file);
-        std::fclose(file);
-    }
-    auto prop(const Eigen::Vector3d &p) { (void) p; return _prop; }
-    Eigen::Vector3d color(const Eigen::Vector3d &p) {
+    Texture texture; double d, lod = 0.;
+    bool from_file(const char *filename) { return texture.load(filename); }
+    Eigen::Vector3d color(const Vector3 &p) {
         (void) p; return {1., 1., 1.};
     }
-    Eigen::Vector3d radiation(const Eigen::Vector3d &p) {
-        Eigen::Vector3d rel = p - this->o;
-        double wa = rel.dot(a), wb = rel.dot(b);
-        std::int64_t x = wa / d, y = ys - wb / d;
-        if (x < 0 || x >= xs || y < 0 || y >= ys)
+    Eigen::Vector3d radiation(const Vector3 &p) {
+        Vector3 rel = p - this->o;
+        double x = rel.dot(a) / d, y = texture.ys - rel.dot(b) / d;
+        if (!(x >= 0. && x < texture.xs && y >= 0. && y < texture.ys))
             return {.0, .0, .0};
-        return data[y*xs+x];
+        return texture.sample(x, y, lod);
+    }
+    void parameters(const std::function<void(double)> &add) const {
+        for (double v : _prop)
+            add(v);
+        add(d); add(lod); texture.identify(add);
     }
 };
 
 struct Scene : std::vector<std::unique_ptr<Object>> {
-    Eigen::Vector3d transmit(const Ray &ray) {
-        Object *nearest = nullptr; double t = 0.;
+    Bvh bvh; std::vector<Object *> emitters; std::vector<double> emitter_cdf;
+    // Precomputes per-object sampling tables, the list of lights for
+    // next-event estimation (chosen in proportion to their power) and
+    // reorders the objects into BVH leaf order; call again after adding
+    // objects. An empty hierarchy falls back to testing every object.
+    // Virtual, like clear(), so that a TypedScene reached through a Scene
+    // keeps its arrays in step.
+    virtual void build() {
+        std::vector<Object *> objs;
+        for (auto &obj : *this)
+            objs.push_back(obj.get());
+        __lights(objs);
+        __hierarchy();
+    }
+    // Prepares the objects and lists those that emit, ordered by power and
+    // bounds rather than by where they are stored, so that a scene samples
+    // its lights alike however it keeps its objects.
+    void __lights(const std::vector<Object *> &objs) {
+        std::vector<std::pair<std::array<double, 7>, Object *>> lights;
+        for (auto *obj : objs) {
+            obj->prepare();
+            obj->emitter_pdf = 0.;
+            if (double power = obj->power(); power > 0.) {
+                Aabb box = obj->bounds();
+                lights.push_back({{power, box.lo.x(), box.lo.y(),
+                    box.lo.z(), box.hi.x(), box.hi.y(), box.hi.z()}, obj});
+            }
+        }
+        std::sort(lights.begin(), lights.end(), [](const auto &a,
+                const auto &b) { return a.first < b.first; });
+        double total = 0.;
+        emitters.clear(); emitter_cdf.clear();
+        for (auto &[key, obj] : lights) {
+            emitters.push_back(obj);
+            emitter_cdf.push_back(total += key[0]);
+        }
+        for (std::size_t i=0; i<emitters.size(); ++i) {
+            double power = emitter_cdf[i] - (i ? emitter_cdf[i-1] : 0.);
+            emitter_cdf[i] /= total;
+            emitters[i]->emitter_pdf = power / total / emitters[i]->area();
+        }
+    }
+    // Builds the BVH over the objects, stores them in its leaf order and
+    // numbers them.
+    void __hierarchy() {
+        std::vector<Aabb> boxes;
+        for (auto &obj : *this)
+            boxes.push_back(obj->bounds());
+        auto order = bvh.build(boxes);
+        std::vector<std::unique_ptr<Object>> objs;
+        for (auto i : order)
+            objs.push_back(std::move((*this)[i]));
+        for (std::size_t i=0; i<size(); ++i) {
+            (*this)[i] = std::move(objs[i]);
+            (*this)[i]->id = i;
+        }
+    }
+    // Removes every object, wherever the scene keeps it.
+    virtual void clear() { vector::clear(); }
+    // Calls f on every object, wherever the scene keeps it.
+    virtual void for_each_object(const std::function<void(Object &)> &f) {
+        for (auto &obj : *this)
+            f(*obj);
+    }
+    // Box around all objects; empty (lo above hi) if there are none.
+    Aabb bounds() {
+        Aabb box = Aabb::empty();
+        for_each_object([&](Object &obj) { box.extend(obj.bounds()); });
+        return box;
+    }
+    // Virtual once per ray so that TypedScene can replace the search;
+    // the integrators below reach it only through these two.
+    virtual Object *intersects_with(const Ray &ray, Real &t) {
+        if (!bvh.nodes.empty()) {
+            auto i = bvh.nearest(ray, t, [&](std::uint32_t i) {
+                return (*this)[i]->intersects_with(ray);
+            });
+            return i < 0 ? nullptr : (*this)[i].get();
+        }
+        Object *nearest = nullptr; t = 0;
         for (auto &obj : *this) {
-            double _t = obj->intersects_with(ray);
+            Real _t = obj->intersects_with(ray);
             if (_t > 0. && (!nearest || _t < t)) {
                 nearest = obj.get();
                 t = _t;
             }
         }
-        if (!nearest)
+        return nearest;
+    }
+    virtual void intersects_with(const RayPacket<PACKET> &rays,
+            Real (&t)[PACKET], Object *(&nearest)[PACKET]) {
+        Real _t[PACKET];
+        if (!bvh.nodes.empty()) {
+            std::int64_t found[PACKET];
+            bvh.nearest(rays, t, found, [&](std::uint32_t i,
+                    Real (&_t)[PACKET]) {
+                (*this)[i]->intersects_with(rays, _t);
+            });
+            for (int i=0; i<PACKET; ++i)
+                nearest[i] = found[i] < 0 ? nullptr : (*this)[found[i]].get();
+            return;
+        }
+        for (int i=0; i<PACKET; ++i) {
+            nearest[i] = nullptr; t[i] = 0;
+        }
+        for (auto &obj : *this) {
+            obj->intersects_with(rays, _t);
+            for (int i=0; i<PACKET; ++i)
+                if (_t[i] > 0. && (!nearest[i] || _t[i] < t[i])) {
+                    nearest[i] = obj.get();
+                    t[i] = _t[i];
+                }
+        }
+    }
+    Eigen::Vector3d transmit(const Ray &ray, CounterRng &rng) {
+        Real t; Object *nearest = intersects_with(ray, t);
+        return transmit(nearest, t, ray, rng);
+    }
+    // Traces the first n lanes of a packet; the rest are padding. Fills
+    // `feature` for each lane's first hit if given.
+    void transmit(const RayPacket<PACKET> &rays, int n, CounterRng *rng,
+            Eigen::Vector3d *radiation, bool nee = false,
+            Feature *feature = nullptr) {
+        Real t[PACKET]; Object *nearest[PACKET];
+        intersects_with(rays, t, nearest);
+        for (int i=0; feature && i<n; ++i) {
+            Ray ray{rays[i].o+t[i]*rays[i].d, rays[i].d};
+            feature[i] = nearest[i] ? Feature{nearest[i]->albedo(ray.o),
+                nearest[i]->normal(ray).cast<double>(), t[i]}
+                : Feature{{0., 0., 0.}, {0., 0., 0.}, 0.};
+        }
+        for (int i=0; i<n; ++i)
+            radiation[i] = nee
+                ? transmit_nee(nearest[i], t[i], rays[i], rng[i], 0.)
+                : transmit(nearest[i], t[i], rays[i], rng[i]);
+    }
+    // Shades a hit already found at distance t along the ray.
+    Eigen::Vector3d transmit(Object *nearest,
+            Real t, const Ray &ray, CounterRng &rng) {
+        if (!nearest) {
+            telemetry::path_end(rng.depth, false);
             return {0., 0., 0.};
-        Eigen::Vector3d radiation, color; Ray ray_new{ray.o+t*ray.d, ray.d};
-        if (nearest->transmit(radiation, color, ray_new))
-            radiation += (color.array()*transmit(ray_new).array()).matrix();
+        }
+        Eigen::Vector3d radiation, color; Bounce bounce;
+        Ray ray_new{ray.o+t*ray.d, ray.d}; rng.next_bounce();
+        if (nearest->transmit(radiation, color, ray_new, rng, bounce)) {
+            telemetry::secondary_ray();
+            radiation += (color.array()
+                * transmit(ray_new, rng).array()).matrix();
+        } else
+            telemetry::path_end(rng.depth, true);
         return radiation;
     }
+    static double power_heuristic(double a, double b) {
+        return a*a / (a*a + b*b);
+    }
+    // Path tracing with next-event estimation: every diffuse bounce also
+    // samples a point on a light and traces a shadow ray to it, and the two
+    // strategies are combined with the power heuristic. pdf is the density
+    // of the diffuse bounce that produced the ray, or 0. after the camera or
+    // a specular event, which light sampling cannot reproduce.
+    Eigen::Vector3d transmit_nee(Object *nearest, Real t,
+            const Ray &ray, CounterRng &rng, Real pdf) {
+        if (!nearest) {
+            telemetry::path_end(rng.depth, false);
+            return {0., 0., 0.};
+        }
+        Eigen::Vector3d radiation, color; Bounce bounce;
+        Ray ray_new{ray.o+t*ray.d, ray.d}; rng.next_bounce();
+        bool alive = nearest->transmit(radiation, color, ray_new, rng, bounce);
+        if (pdf > 0. && nearest->emitter_pdf > 0.)
+            radiation *= power_heuristic(
+                    pdf, nearest->light_pdf({ray_new.o, ray.d}, t));
+        if (!alive) {
+            telemetry::path_end(rng.depth, true);
+            return radiation;
+        }
+        Eigen::Vector3d incoming{0., 0., 0.};
+        if (bounce.diffuse)
+            incoming = direct(ray_new.o, bounce, rng);
+        telemetry::secondary_ray();
+        Real _t; Object *next = intersects_with(ray_new, _t);
+        incoming += transmit_nee(next, _t, ray_new, rng,
+                bounce.diffuse ? bounce.pdf : 0.);
+        return radiation + (color.array()*incoming.array()).matrix();
+    }
+    // Light arriving at p from one sampled point on one sampled light,
+    // divided by its density and MIS-weighted against the diffuse bounce.
+    Eigen::Vector3d direct(const Vector3 &p,
+            const Bounce &bounce, CounterRng &rng) {
+        using uniform = std::uniform_real_distribution<>;
+        if (emitters.empty())
+            return {0., 0., 0.};
+        rng.seek(CounterRng::LIGHT);
+        double u = uniform(0., 1.)(rng);
+        std::size_t i = std::upper_bound(
+                emitter_cdf.begin(), emitter_cdf.end(), u)
+            - emitter_cdf.begin();
+        Object *light = emitters[std::min(i, emitters.size()-1)];
+        rng.seek(CounterRng::LIGHT_POINT);
+        Real su = uniform(0., 1.)(rng), sv = uniform(0., 1.)(rng);
+        Vector3 q = light->sample_surface(su, sv), w = q - p;
+        Real dist = w.norm(); w /= dist;
+        double pdf_bounce = RayTransformer{w, bounce.n}.diffuse_pdf(w);
+        if (pdf_bounce == 0.)
+            return {0., 0., 0.};
+        telemetry::shadow_ray();
+        Real t; Object *hit = intersects_with({p, w}, t);
+        if (hit != light
+                || std::abs(t - dist) > Precision<Real>::MATCH*dist)
+            return {0., 0., 0.};
+        double pdf_light = light->light_pdf({q, w}, dist);
+        if (!(pdf_light > 0.))
+            return {0., 0., 0.};
+        return light->emission(q) * (pdf_bounce / pdf_light
+            * power_heuristic(pdf_light, pdf_bounce));
+    }
 };
 
 struct Camera {
-    Eigen::Vector3d e, n, a, b; double d;
-    std::minstd_rand *rng; Scene *scene;
-    Eigen::Vector3d transmit(std::int64_t _x, std::int64_t _y) {
+    Vector3 e, n, a, b; double d;
+    Scene *scene;
+    Ray ray(std::int64_t _x, std::int64_t _y, CounterRng &rng) {
         using uniform = std::uniform_real_distribution<>;
         uniform dist(0., d);
-        double x = _x*d + dist(*rng), y = _y*d + dist(*rng);
-        Eigen::Vector3d v = n + a*x + b*y;
-        return scene->transmit({e, v.normalized()});
+        Real x = _x*d + dist(rng), y = _y*d + dist(rng);
+        Vector3 v = n + a*x + b*y;
+        telemetry::primary_ray();
+        return {e, v.normalized()};
+    }
+    Eigen::Vector3d transmit(
+            std::int64_t _x, std::int64_t _y, CounterRng &rng) {
+        return scene->transmit(ray(_x, _y, rng), rng);
+    }
+    // Traces the n <= PACKET pixels (_x, _y), (_x, _y-1), ... as a packet.
+    void transmit(std::int64_t _x, std::int64_t _y, int n, CounterRng *rng,
+            Eigen::Vector3d *radiation, bool nee = false,
+            Feature *feature = nullptr) {
+        RayPacket<PACKET> rays;
+        for (int i=0; i<n; ++i)
+            rays.set(i, ray(_x, _y-i, rng[i]));
+        for (int i=n; i<PACKET; ++i)
+            rays.set(i, rays[0]);
+        scene->transmit(rays, n, rng, radiation, nee, feature);
+    }
+};
+
+// Breadth-first alternative to the recursive Scene::transmit for one tile
+// of one pass. Path state lives in flat arrays indexed through `live`;
+// each bounce intersects all live paths as packets, sorts them by material
+// and object so that shading runs coherently, then compacts out the paths
+// that were absorbed or escaped.
+struct WavefrontTile {
+    std::vector<Ray> ray; std::vector<Eigen::Vector3d> throughput, radiance;
+    std::vector<CounterRng> rng; std::vector<Object *> nearest;
+    std::vector<Real> t; std::vector<std::uint32_t> live;
+    // Makes room for n paths, so that tiles of up to n pixels reuse it.
+    void reserve(std::size_t n) {
+        ray.reserve(n); throughput.reserve(n); radiance.reserve(n);
+        rng.reserve(n); nearest.reserve(n); t.reserve(n); live.reserve(n);
+    }
+    void generate(Camera &camera, std::int64_t x0, std::int64_t y0,
+            std::int64_t x1, std::int64_t y1, std::int64_t xs,
+            std::int64_t ys, std::uint64_t seed, std::int64_t pass,
+            Sequence sequence) {
+        std::size_t n = (x1-x0) * (y1-y0);
+        ray.resize(n); throughput.assign(n, {1., 1., 1.});
+        radiance.assign(n, {0., 0., 0.}); rng.resize(n);
+        nearest.resize(n); t.resize(n); live.resize(n);
+        std::size_t i = 0;
+        for (std::int64_t y=y0; y<y1; ++y)
+            for (std::int64_t x=x0; x<x1; ++x, ++i) {
+                rng[i] = CounterRng::for_path(seed, y*xs+x, pass, sequence);
+                ray[i] = camera.ray(x-xs/2, ys/2-y, rng[i]);
+                live[i] = i;
+            }
+    }
+    void intersect(Scene &scene) {
+        RayPacket<PACKET> rays; Real _t[PACKET]; Object *_nearest[PACKET];
+        for (std::size_t i0=0; i0<live.size(); i0+=PACKET) {
+            int n = std::min<std::size_t>(PACKET, live.size()-i0);
+            for (int j=0; j<PACKET; ++j)
+                rays.set(j, ray[live[i0 + (j<n ? j : 0)]]);
+            scene.intersects_with(rays, _t, _nearest);
+            for (int j=0; j<n; ++j) {
+                t[live[i0+j]] = _t[j]; nearest[live[i0+j]] = _nearest[j];
+            }
+        }
+    }
+    void sort() {
+        std::sort(live.begin(), live.end(),
+                [&](std::uint32_t i, std::uint32_t j) {
+            Material mi = nearest[i] ? nearest[i]->material() : Material{};
+            Material mj = nearest[j] ? nearest[j]->material() : Material{};
+            return mi != mj ? mi < mj
+                : std::less<Object *>()(nearest[i], nearest[j]);
+        });
+    }
+    void shade() {
+        for (auto &i : live) {
+            if (!nearest[i]) {
+                telemetry::path_end(rng[i].depth, false);
+                i = -1;
+                continue;
+            }
+            Eigen::Vector3d radiation, color; Bounce bounce;
+            Ray ray_new{ray[i].o+t[i]*ray[i].d, ray[i].d};
+            rng[i].next_bounce();
+            bool alive = nearest[i]->transmit(
+                    radiation, color, ray_new, rng[i], bounce);
+            radiance[i] += (throughput[i].array()*radiation.array()).matrix();
+            if (alive) {
+                throughput[i] = (throughput[i].array()*color.array()).matrix();
+                ray[i] = ray_new;
+                telemetry::secondary_ray();
+            } else {
+                telemetry::path_end(rng[i].depth, true);
+                i = -1;
+            }
+        }
+    }
+    void compact() {
+        live.erase(std::remove(live.begin(), live.end(), std::uint32_t(-1)),
+                live.end());
+    }
+    void trace(Scene &scene) {
+        while (!live.empty()) {
+            intersect(scene); sort(); shade(); compact();
+        }
     }
 };
 
+// Accumulation buffer stored as square TILE x TILE tiles, each contiguous
+// in memory. Alongside the radiance sums it keeps per-pixel sums of squared
+// luminance and per-tile sample counts, from which converge() estimates the
+// relative error of each tile and retires the tiles that reached a target;
+// capture() only renders the rest.
+//
+// File format: count, xs, ys and the row-major sums scaled to `count`
+// samples per pixel, which is all data2png.py reads; then the per-tile
+// sample counts, the per-tile counts of samples included in the moments,
+// and the row-major moments. Files without the trailing sections load as
+// `count` samples everywhere and no variance information.
 struct Screen {
-    std::vector<Eigen::Vector3d> data;
+    static constexpr std::int64_t TILE = 32, MIN_SAMPLES = 16;
+    static constexpr double ERROR_FLOOR = 1./64;
+    std::vector<Eigen::Vector3d> data; std::vector<double> moment;
     std::int64_t xs, ys; std::int64_t count;
+    std::int64_t xt, yt; std::vector<std::int64_t> samples, moment_samples;
+    std::vector<char> active; std::vector<std::int64_t> tasks;
+    WorkStealingScheduler scheduler; Sequence sequence = Sequence::random;
+    // The wavefront integrator's buffers, one per thread, sized for a tile
+    // and kept across calls so that a pass does not allocate.
+    std::vector<WavefrontTile> wavefronts;
+    // Set from a signal handler to make capture() return early.
+    const volatile std::sig_atomic_t *interrupt = nullptr;
+    // Index of the first pass, so that shards of one image rendered by
+    // separate processes draw disjoint samples.
+    std::int64_t first_pass = 0;
+    // Called by the rendering thread after each tile's passes in capture().
+    std::function<void(const Screen &, std::int64_t)> tile_done;
+    // Sums of the camera rays' first-hit features, in the layout of `data`,
+    // over feature_samples[k] samples in tile k, which may be fewer than
+    // samples[k] as the wavefront integrator records none; empty unless
+    // record_features() was called. Checkpoints keep them, files do not.
+    std::vector<Eigen::Vector3d> albedo, normal; std::vector<double> depth;
+    std::vector<std::int64_t> feature_samples;
+    std::int64_t index(std::int64_t x, std::int64_t y) const {
+        return ((y/TILE)*xt + x/TILE)*TILE*TILE + (y%TILE)*TILE + x%TILE;
+    }
     auto &operator()(std::int64_t x, std::int64_t y) {
-        return data[y*xs+x];
+        return data[index(x, y)];
+    }
+    void accumulate(std::int64_t x, std::int64_t y, const Eigen::Vector3d &v) {
+        std::int64_t i = index(x, y); double l = luminance(v);
+        data[i] += v; moment[i] += l*l;
+    }
+    void __resize() {
+        xt = (xs+TILE-1) / TILE; yt = (ys+TILE-1) / TILE;
+        data.assign(xt*yt*TILE*TILE, {0., 0., 0.});
+        moment.assign(data.size(), 0.);
+        samples.assign(xt*yt, 0); moment_samples.assign(xt*yt, 0);
+        active.assign(xt*yt, 1);
+        if (!albedo.empty())
+            record_features();
+    }
+    // Keeps first-hit features from now on (packet integrators only).
+    void record_features() {
+        albedo.assign(data.size(), {0., 0., 0.});
+        normal.assign(data.size(), {0., 0., 0.});
+        depth.assign(data.size(), 0.); feature_samples.assign(xt*yt, 0);
     }
     void initialize_data(std::int64_t _xs, std::int64_t _ys) {
-        xs = _xs; ys = _ys; data.resize(xs*ys);
-        for (auto &v : data)
-            v.fill(0.);
-        count = 0;
+        xs = _xs; ys = _ys; count = 0; __resize();
     }
     bool from_file(const char *filename) {
         std::FILE *file = std::fopen(filename, "rb");
         if (!file)
             return false;
-        std::fread(&count, 8, 1, file);
-        std::fread(&xs, 8, 1, file);
-        std::fread(&ys, 8, 1, file);
-        data.resize(xs*ys);
-        std::fread(data.data(), sizeof(Eigen::Vector3d), data.size(), file);
+        std::int64_t header[3];
+        if (std::fread(header, 8, 3, file) != 3 || header[1] <= 0
+                || header[2] <= 0) {
+            std::fclose(file);
+            return false;
+        }
+        count = header[0]; xs = header[1]; ys = header[2];
+        __resize();
+        std::vector<Eigen::Vector3d> row(xs);
+        for (std::int64_t y=0; y<ys; ++y) {
+            std::fread(row.data(), sizeof(Eigen::Vector3d), xs, file);
+            for (std::int64_t x=0; x<xs; ++x)
+                (*this)(x, y) = row[x];
+        }
+        bool extended = std::fread(
+                samples.data(), 8, samples.size(), file) == samples.size()
+            && std::fread(moment_samples.data(), 8,
+                moment_samples.size(), file) == moment_samples.size();
+        std::vector<double> moment_row(xs);
+        for (std::int64_t y=0; extended && y<ys; ++y) {
+            extended = std::fread(
+                    moment_row.data(), 8, xs, file) == std::size_t(xs);
+            for (std::int64_t x=0; x<xs; ++x)
+                moment[index(x, y)] = moment_row[x];
+        }
         std::fclose(file);
+        if (!extended) {
+            samples.assign(xt*yt, count); moment_samples.assign(xt*yt, 0);
+            moment.assign(data.size(), 0.);
+        }
+        for (std::int64_t y=0; y<ys; ++y)
+            for (std::int64_t x=0; x<xs; ++x)
+                (*this)(x, y) *= count ? double(__samples(x, y))/count : 0.;
         return true;
     }
     bool to_file(const char *filename) {
@@ -165,17 +721,280 @@ struct Screen {
         std::fwrite(&count, 8, 1, file);
         std::fwrite(&xs, 8, 1, file);
         std::fwrite(&ys, 8, 1, file);
-        std::fwrite(data.data(), sizeof(Eigen::Vector3d), data.size(), file);
+        std::vector<Eigen::Vector3d> row(xs);
+        for (std::int64_t y=0; y<ys; ++y) {
+            for (std::int64_t x=0; x<xs; ++x) {
+                std::int64_t n = __samples(x, y);
+                row[x] = n ? ((*this)(x, y)*count/n).eval()
+                    : Eigen::Vector3d{0., 0., 0.};
+            }
+            std::fwrite(row.data(), sizeof(Eigen::Vector3d), xs, file);
+        }
+        std::fwrite(samples.data(), 8, samples.size(), file);
+        std::fwrite(moment_samples.data(), 8, moment_samples.size(), file);
+        std::vector<double> moment_row(xs);
+        for (std::int64_t y=0; y<ys; ++y) {
+            for (std::int64_t x=0; x<xs; ++x)
+                moment_row[x] = moment[index(x, y)];
+            std::fwrite(moment_row.data(), 8, xs, file);
+        }
         std::fclose(file);
         return true;
     }
-    void capture(Camera &camera) {
+    // Adds the samples of another render of the same image, e.g. a shard
+    // with its own passes; each tile's mean is weighted by sample count.
+    void merge(const Screen &other) {
+        for (std::size_t i=0; i<data.size(); ++i) {
+            data[i] += other.data[i]; moment[i] += other.moment[i];
+        }
+        for (std::size_t k=0; k<samples.size(); ++k) {
+            samples[k] += other.samples[k];
+            moment_samples[k] += other.moment_samples[k];
+        }
+        count += other.count;
+    }
+    std::int64_t __samples(std::int64_t x, std::int64_t y) const {
+        return samples[(y/TILE)*xt + x/TILE];
+    }
+    // RMS over the tile's pixels of the standard error of the mean
+    // luminance, relative to that mean (floored at ERROR_FLOOR so that
+    // dark pixels do not dominate).
+    double error(std::int64_t k) const {
+        std::int64_t n = samples[k], m = moment_samples[k];
+        if (m < MIN_SAMPLES)
+            return std::numeric_limits<double>::infinity();
+        std::int64_t x0 = k%xt*TILE, y0 = k/xt*TILE;
+        std::int64_t x1 = std::min(x0+TILE, xs), y1 = std::min(y0+TILE, ys);
+        double sum = 0.;
+        for (std::int64_t y=y0; y<y1; ++y)
+            for (std::int64_t x=x0; x<x1; ++x) {
+                std::int64_t i = index(x, y);
+                double mean = luminance(data[i]) / n;
+                double var = std::max(moment[i]/m - mean*mean, 0.);
+                double e = std::sqrt(var/n) / std::max(mean, ERROR_FLOOR);
+                sum += e*e;
+            }
+        return std::sqrt(sum / ((x1-x0)*(y1-y0)));
+    }
+    // Retires the tiles whose error is below `target`; true once all are.
+    bool converge(double target) {
+        bool done = true;
+        for (std::int64_t k=0; k<xt*yt; ++k) {
+            active[k] = error(k) >= target;
+            done &= !active[k];
+        }
+        return done;
+    }
+    // Renders `passes` passes over the active tiles. Threads take whole
+    // tiles from the work-stealing scheduler and render every pass of a
+    // tile before moving on, so the only barrier is at the end of the call.
+    // Once *interrupt is set every thread stops after its current pass of
+    // a tile. Each tile's sample count records the passes it received and
+    // numbers its next one; `count` grows by the passes every active tile
+    // completed, so it never claims samples a tile does not have.
+    void capture(Camera &camera, std::uint64_t seed, std::int64_t passes = 1,
+            Integrator integrator = Integrator::recursive) {
+        auto start = telemetry::start();
+        tasks.clear();
+        for (std::int64_t k=0; k<xt*yt; ++k)
+            if (active[k])
+                tasks.push_back(k);
+        std::int64_t completed = passes; std::size_t started = 0;
+#pragma omp parallel reduction(min: completed) reduction(+: started)
+        {
+#pragma omp single
+            {
+                scheduler.reset(thread_count(), tasks.size());
+                wavefronts.resize(thread_count());
+                if (integrator == Integrator::wavefront)
+                    for (auto &wavefront : wavefronts)
+                        wavefront.reserve(TILE*TILE);
+            }
+            auto &wavefront = wavefronts[thread_index()]; std::int64_t i;
+            while (!__interrupted() && scheduler.pop(thread_index(), i)) {
+                std::int64_t k = tasks[i], done = 0;
+                for (; done<passes && !__interrupted(); ++done)
+                    capture_tile(camera, seed, first_pass+samples[k]+done, k,
+                            integrator, wavefront);
+                samples[k] += done;
+                moment_samples[k] += done;
+                if (!albedo.empty() && integrator != Integrator::wavefront)
+                    feature_samples[k] += done;
+                if (tile_done)
+                    tile_done(*this, k);
+                completed = std::min(completed, done); ++started;
+            }
+        }
+        if (started < tasks.size())
+            completed = 0;
+        count += completed;
+        telemetry::passes(completed, start);
+    }
+    bool __interrupted() const { return interrupt && *interrupt; }
+    void capture_tile(Camera &camera, std::uint64_t seed, std::int64_t pass,
+            std::int64_t k, Integrator integrator, WavefrontTile &wavefront) {
+        std::int64_t x0 = k%xt*TILE, y0 = k/xt*TILE;
+        std::int64_t x1 = std::min(x0+TILE, xs), y1 = std::min(y0+TILE, ys);
+        if (integrator == Integrator::wavefront) {
+            wavefront.generate(
+                    camera, x0, y0, x1, y1, xs, ys, seed, pass, sequence);
+            wavefront.trace(*camera.scene);
+            std::size_t i = 0;
+            for (std::int64_t y=y0; y<y1; ++y)
+                for (std::int64_t x=x0; x<x1; ++x, ++i)
+                    accumulate(x, y, wavefront.radiance[i]);
+            return;
+        }
         std::int64_t xs_half = xs / 2, ys_half = ys / 2;
-#pragma omp parallel for schedule(dynamic, 1)
-        for (std::int64_t x=0; x<xs; ++x)
-            for (std::int64_t y=0; y<ys; ++y)
-                (*this)(x, y) += camera.transmit(x-xs_half, ys_half-y);
-        ++count;
+        for (std::int64_t x=x0; x<x1; ++x)
+            for (std::int64_t y=y0; y<y1; y+=PACKET) {
+                int n = std::min<std::int64_t>(PACKET, y1-y);
+                CounterRng rng[PACKET]; Eigen::Vector3d radiation[PACKET];
+                Feature feature[PACKET]; bool features = !albedo.empty();
+                for (int i=0; i<n; ++i)
+                    rng[i] = CounterRng::for_path(
+                            seed, (y+i)*xs+x, pass, sequence);
+                camera.transmit(x-xs_half, ys_half-y, n, rng, radiation,
+                        integrator == Integrator::nee,
+                        features ? feature : nullptr);
+                for (int i=0; i<n; ++i)
+                    accumulate(x, y+i, radiation[i]);
+                for (int i=0; features && i<n; ++i) {
+                    std::int64_t j = index(x, y+i);
+                    albedo[j] += feature[i].albedo;
+                    normal[j] += feature[i].normal;
+                    depth[j] += feature[i].depth;
+                }
+            }
+    }
+};
+
+// A Scene that moves its objects of the listed types out of the base
+// vector into one contiguous array per type, held by value, and finds the
+// nearest hit by calling each type's final intersects_with directly, so
+// the per-object tests are not virtual calls and can inline. The objects
+// are still Objects: shading a hit is one virtual call as before. A type
+// with more than LINEAR objects gets its own BVH, searched only up to the
+// nearest hit found in the types before it. Objects of other types stay in
+// the base vector, with its BVH, and are searched by Scene's functions.
+template<class... Ts> struct TypedScene final : Scene {
+    static constexpr std::size_t LINEAR = 8;
+    template<class T> struct Shapes {
+        std::vector<T> items; Bvh bvh;
+    };
+    std::tuple<Shapes<Ts>...> shapes;
+
+    TypedScene() = default;
+    explicit TypedScene(Scene &&scene) : Scene(std::move(scene)) { build(); }
+    // Moves the listed objects into the arrays, each stored in the order of
+    // its BVH, and builds the base Scene on the rest. Call again after
+    // adding objects.
+    void build() final {
+        (__collect<Ts>(), ...);
+        erase(std::remove(begin(), end(), nullptr), end());
+        std::vector<Object *> objs;
+        for_each_object([&](Object &obj) { objs.push_back(&obj); });
+        __lights(objs);
+        __hierarchy();
+        std::size_t id = size();
+        (__number<Ts>(id), ...);
+    }
+    template<class T> void __collect() {
+        auto &s = std::get<Shapes<T>>(shapes);
+        for (auto &obj : *this)
+            if (obj && typeid(*obj) == typeid(T)) {
+                s.items.push_back(std::move(static_cast<T &>(*obj)));
+                obj.reset();
+            }
+        std::vector<Aabb> boxes;
+        for (auto &item : s.items)
+            boxes.push_back(item.bounds());
+        std::vector<T> items; items.reserve(s.items.size());
+        for (auto k : s.bvh.build(boxes))
+            items.push_back(std::move(s.items[k]));
+        s.items = std::move(items);
+    }
+    // Adds an object of a listed type straight to its array, without a
+    // heap allocation of its own; build() places it with the rest.
+    template<class T> void insert(T obj) {
+        std::get<Shapes<T>>(shapes).items.push_back(std::move(obj));
+    }
+    void clear() final {
+        Scene::clear();
+        (std::get<Shapes<Ts>>(shapes).items.clear(), ...);
+    }
+    template<class T> void __number(std::size_t &id) {
+        for (auto &item : std::get<Shapes<T>>(shapes).items)
+            item.id = id++;
+    }
+    void for_each_object(const std::function<void(Object &)> &f) final {
+        Scene::for_each_object(f);
+        (__for_each<Ts>(f), ...);
+    }
+    template<class T> void __for_each(
+            const std::function<void(Object &)> &f) {
+        for (auto &item : std::get<Shapes<T>>(shapes).items)
+            f(item);
+    }
+    Object *intersects_with(const Ray &ray, Real &t) final {
+        Object *nearest = Scene::intersects_with(ray, t);
+        (__nearest<Ts>(ray, t, nearest), ...);
+        return nearest;
+    }
+    template<class T> void __nearest(
+            const Ray &ray, Real &t, Object *&nearest) {
+        auto &s = std::get<Shapes<T>>(shapes);
+        if (s.items.size() <= LINEAR) {
+            for (auto &item : s.items) {
+                Real _t = item.intersects_with(ray);
+                if (_t > 0. && (!nearest || _t < t)) {
+                    nearest = &item;
+                    t = _t;
+                }
+            }
+            return;
+        }
+        Real _t; auto i = s.bvh.nearest(ray, _t, [&](std::uint32_t i) {
+            return s.items[i].intersects_with(ray);
+        }, nearest ? t : std::numeric_limits<Real>::infinity());
+        if (i >= 0) {
+            nearest = &s.items[i];
+            t = _t;
+        }
+    }
+    void intersects_with(const RayPacket<PACKET> &rays,
+            Real (&t)[PACKET], Object *(&nearest)[PACKET]) final {
+        Scene::intersects_with(rays, t, nearest);
+        (__nearest<Ts>(rays, t, nearest), ...);
+    }
+    template<class T> void __nearest(const RayPacket<PACKET> &rays,
+            Real (&t)[PACKET], Object *(&nearest)[PACKET]) {
+        auto &s = std::get<Shapes<T>>(shapes);
+        Real _t[PACKET];
+        if (s.items.size() <= LINEAR) {
+            for (auto &item : s.items) {
+                item.intersects_with(rays, _t);
+                for (int i=0; i<PACKET; ++i)
+                    if (_t[i] > 0. && (!nearest[i] || _t[i] < t[i])) {
+                        nearest[i] = &item;
+                        t[i] = _t[i];
+                    }
+            }
+            return;
+        }
+        Real t_max[PACKET]; std::int64_t found[PACKET];
+        for (int i=0; i<PACKET; ++i)
+            t_max[i] = nearest[i] ? t[i]
+                : std::numeric_limits<Real>::infinity();
+        s.bvh.nearest(rays, _t, found, [&](std::uint32_t j,
+                Real (&_t)[PACKET]) {
+            s.items[j].intersects_with(rays, _t);
+        }, t_max);
+        for (int i=0; i<PACKET; ++i)
+            if (found[i] >= 0) {
+                nearest[i] = &s.items[found[i]];
+                t[i] = _t[i];
+            }
     }
 };
 
@@ -189,4 +1008,6 @@ using WaterDropSCO = OpaqueObject<Inh2<
         shapes::WaterDrop, SolidColorOpaqueBase>>;
 using WaterDropT = TransparentObject<shapes::WaterDrop>;
 using LEDSCO = OpaqueObject<LEDOpaqueBase>;
+using TypedAll = TypedScene<SphereSCO, SphereT, DefiniteRectangleSCO,
+        WaterDropSCO, WaterDropT, LEDSCO>;
 }
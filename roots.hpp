@@ -0,0 +1,121 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+
+
+// Sturm sequence of the degree-N polynomial c[0] + c[1]x + ... + c[N]x^N,
+// kept in fixed-size storage so that isolating a root never allocates.
+// Roots are bracketed by bisection on the number of sign variations and
+// then refined with Newton steps safeguarded by bisection; a root is
+// reported to within TOL, or as the midpoint of a cluster narrower than
+// TOL when several roots cannot be separated.
+template<int N> struct SturmSequence {
+    static constexpr double TOL = 1e-12;
+    static constexpr int MAX_DEPTH = 64;
+    double p[N+1][N+1]; int deg[N+1]; int len;
+
+    explicit SturmSequence(const double (&c)[N+1]) {
+        double scale = 0.;
+        for (int i=0; i<=N; ++i) {
+            p[0][i] = c[i];
+            scale = std::max(scale, std::abs(c[i]));
+        }
+        deg[0] = __trim(p[0], N, scale);
+        for (int i=1; i<=deg[0]; ++i)
+            p[1][i-1] = i * p[0][i];
+        deg[1] = deg[0] - 1; len = deg[0] > 0 ? 2 : 1;
+        while (len <= N && deg[len-1] > 0) {
+            // p[len] = -(p[len-2] mod p[len-1])
+            const double *a = p[len-2], *b = p[len-1];
+            int da = deg[len-2], db = deg[len-1];
+            double r[N+1], r_scale = 0.;
+            for (int i=0; i<=da; ++i) {
+                r[i] = a[i];
+                r_scale = std::max(r_scale, std::abs(a[i]));
+            }
+            for (int i=da; i>=db; --i) {
+                double q = r[i] / b[db];
+                for (int j=0; j<=db; ++j)
+                    r[i-db+j] -= q * b[j];
+            }
+            int dr = __trim(r, db-1, r_scale);
+            if (dr < 0)
+                break;
+            for (int i=0; i<=dr; ++i)
+                p[len][i] = -r[i];
+            deg[len++] = dr;
+        }
+    }
+    static int __trim(double *a, int d, double scale) {
+        while (d >= 0 && std::abs(a[d]) <= 1e-13 * scale)
+            --d;
+        return d;
+    }
+    double eval(int k, double x) const {
+        double v = 0.;
+        for (int i=deg[k]; i>=0; --i)
+            v = v*x + p[k][i];
+        return v;
+    }
+    int variations(double x) const {
+        int n = 0; double last = 0.;
+        for (int k=0; k<len; ++k) {
+            double v = eval(k, x);
+            if (v == 0.)
+                continue;
+            if (last != 0. && (v < 0.) != (last < 0.))
+                ++n;
+            last = v;
+        }
+        return n;
+    }
+    // Finds the smallest root in (lo, hi], or the largest one when
+    // `descending` is set.
+    bool first_root(double lo, double hi, bool descending, double &x) const {
+        if (deg[0] <= 0 || lo >= hi)
+            return false;
+        return __first_root(
+                lo, hi, variations(lo), variations(hi), descending, x, 0);
+    }
+    bool __first_root(double lo, double hi, int vlo, int vhi,
+            bool descending, double &x, int depth) const {
+        int n = vlo - vhi;
+        if (n <= 0)
+            return false;
+        double flo = eval(0, lo), fhi = eval(0, hi);
+        if (n == 1 && (flo < 0.) != (fhi < 0.)) {
+            x = __refine(lo, hi, flo);
+            return true;
+        }
+        if (hi - lo <= TOL || depth == MAX_DEPTH) {
+            x = (lo + hi) / 2.;
+            return true;
+        }
+        double mid = (lo + hi) / 2.; int vmid = variations(mid);
+        if (descending)
+            return __first_root(mid, hi, vmid, vhi, true, x, depth+1)
+                || __first_root(lo, mid, vlo, vmid, true, x, depth+1);
+        return __first_root(lo, mid, vlo, vmid, false, x, depth+1)
+            || __first_root(mid, hi, vmid, vhi, false, x, depth+1);
+    }
+    double __refine(double lo, double hi, double flo) const {
+        double x = (lo + hi) / 2.;
+        for (int i=0; i<MAX_DEPTH; ++i) {
+            double f = eval(0, x), df = eval(1, x);
+            if (f == 0.)
+                return x;
+            if ((f < 0.) == (flo < 0.))
+                lo = x;
+            else
+                hi = x;
+            double x_new = x - f / df;
+            if (!(lo < x_new && x_new < hi))
+                x_new = (lo + hi) / 2.;
+            if (std::abs(x_new - x) <= TOL || hi - lo <= TOL)
+                return x_new;
+            x = x_new;
+        }
+        return x;
+    }
+};
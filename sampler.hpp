@@ -0,0 +1,161 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <limits>
+
+
+// Point sets a CounterRng can draw from. Each is addressed by (pixel,
+// sample index, dimension): the pixel selects the randomization, the pass
+// is the sample index and the draw counter is the dimension.
+enum class Sequence { random, stratified, halton, sobol };
+
+// Names of Sequence's values, as given on command lines and in farm.cfg.
+inline constexpr const char *SEQUENCES[] = {
+    "random", "stratified", "halton", "sobol"};
+
+// False, leaving `sequence` alone, if `name` is not one of SEQUENCES.
+inline bool parse_sequence(const char *name, Sequence &sequence) {
+    for (std::size_t i=0; i<std::size(SEQUENCES); ++i)
+        if (!std::strcmp(name, SEQUENCES[i])) {
+            sequence = Sequence(i);
+            return true;
+        }
+    return false;
+}
+
+// Columns of the second dimension's Sobol generator matrix, combined a
+// byte of the index at a time: entry 256*k + b is the XOR of the columns
+// for the set bits of b << 8*k. The matrix is linear over GF(2), so four
+// lookups replace a loop over the 32 bits.
+inline constexpr std::array<std::uint32_t, 1024> SOBOL_TABLE = [] {
+    std::uint32_t v[32] = {1u << 31};
+    for (int bit=1; bit<32; ++bit)
+        v[bit] = v[bit-1] ^ v[bit-1] >> 1;
+    std::array<std::uint32_t, 1024> table{};
+    for (int k=0; k<4; ++k)
+        for (int b=0; b<256; ++b)
+            for (int bit=0; bit<8; ++bit)
+                if (b >> bit & 1)
+                    table[256*k + b] ^= v[8*k + bit];
+    return table;
+}();
+
+// Counter-based generator: each draw is a pure function of (key, index,
+// counter), so a stream keyed by (seed, pixel, pass) is independent of the
+// thread that renders it and nothing is shared between threads.
+//
+// Dimensions are allotted per bounce (next_bounce()), so that the same
+// dimension means the same decision across the samples of a pixel. The
+// first QMC_DIMS dimensions follow `sequence`; later ones, where the
+// low-discrepancy structure no longer pays off, are pseudo-random.
+struct CounterRng {
+    using result_type = std::uint64_t;
+    static constexpr std::uint64_t CAMERA_DIMS = 2, BOUNCE_DIMS = 8,
+        QMC_DIMS = CAMERA_DIMS + 4*BOUNCE_DIMS;
+    std::uint64_t key, counter, index = 0, depth = 0;
+    Sequence sequence = Sequence::random;
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() {
+        return std::numeric_limits<result_type>::max();
+    }
+    static constexpr std::uint64_t mix(std::uint64_t z) {
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+    static CounterRng for_path(std::uint64_t seed, std::uint64_t pixel,
+            std::uint64_t pass, Sequence sequence = Sequence::random) {
+        return {mix(seed ^ mix(pixel + 1)), 0, pass, 0, sequence};
+    }
+    void next_bounce() { counter = CAMERA_DIMS + BOUNCE_DIMS*depth++; }
+    // Offsets of the decisions within a bounce's dimensions: the event
+    // choice comes first (a refraction's Fresnel choice follows it), then
+    // the diffuse direction, the light and the point on it. The 2D draws
+    // start on even dimensions, so each takes one pair of the padded Sobol
+    // sequence.
+    static constexpr std::uint64_t DIRECTION = 2, LIGHT = 4, LIGHT_POINT = 6;
+    void seek(std::uint64_t offset) {
+        counter = CAMERA_DIMS + BOUNCE_DIMS*(depth-1) + offset;
+    }
+    result_type operator()() {
+        std::uint64_t dim = counter++;
+        std::uint64_t bits = mix(mix(key ^ (index + 1))
+                + 0x9e3779b97f4a7c15ull * (dim + 1));
+        if (sequence == Sequence::random || dim >= QMC_DIMS)
+            return bits;
+        std::uint32_t x = sequence == Sequence::stratified
+            ? __stratified(dim, bits)
+            : sequence == Sequence::halton ? __halton(dim) : __sobol(dim);
+        // The low bits jitter within the finest cell of the point set.
+        return std::uint64_t(x) << 32 | (bits & 0xffffffffu);
+    }
+
+    // Padded stratification: each dimension cycles through STRATA strata in
+    // an order shuffled per (pixel, dimension, epoch of STRATA samples).
+    static constexpr std::uint32_t STRATA = 256;
+    std::uint32_t __stratified(std::uint64_t dim, std::uint64_t bits) const {
+        std::uint32_t seed = mix(key ^ mix(dim ^ (index/STRATA << 8)));
+        std::uint32_t stratum = __permute(index % STRATA, seed);
+        return stratum << 24 | (bits >> 40 & 0xffffff);
+    }
+    // Kensler's hash-based permutation of [0, STRATA).
+    static std::uint32_t __permute(std::uint32_t i, std::uint32_t p) {
+        constexpr std::uint32_t w = STRATA - 1;
+        i ^= p; i *= 0xe170893d; i ^= p >> 16; i ^= (i & w) >> 4;
+        i ^= p >> 8; i *= 0x0929eb3f; i ^= p >> 23; i ^= (i & w) >> 1;
+        i *= 1 | p >> 27; i *= 0x6935fa69; i ^= (i & w) >> 11;
+        i *= 0x74dcb303; i ^= (i & w) >> 2; i *= 0x9e501cc3;
+        i ^= (i & w) >> 2; i *= 0xc860a3df; i &= w; i ^= i >> 5;
+        return (i + p) & w;
+    }
+
+    // Radical inverse in the dim-th prime base, toroidally shifted per
+    // (pixel, dimension).
+    std::uint32_t __halton(std::uint64_t dim) const {
+        static constexpr std::uint32_t PRIMES[QMC_DIMS] = {
+            2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53, 59,
+            61, 67, 71, 73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127,
+            131, 137, 139};
+        std::uint64_t base = PRIMES[dim], i = index;
+        double inv = 1. / base, f = inv, r = 0.;
+        for (; i; i /= base, f *= inv)
+            r += f * (i % base);
+        r += (mix(key ^ (dim + 1)) >> 11) * 0x1p-53;
+        r -= r >= 1. ? 1. : 0.;
+        return std::uint32_t(r * 0x1p32);
+    }
+
+    // Owen-scrambled Sobol points, padded: dimensions are taken in pairs
+    // from the 2D Sobol (0, 2)-sequence, each pair with its own shuffled
+    // index and scrambling (Burley, Practical Hash-based Owen Scrambling).
+    // The first dimension is the van der Corput sequence, the bit reversal
+    // of the index.
+    std::uint32_t __sobol(std::uint64_t dim) const {
+        std::uint64_t pair_seed = mix(key ^ mix(dim/2 + 1));
+        std::uint32_t i = __owen(std::uint32_t(index), pair_seed);
+        std::uint32_t x = dim%2
+            ? SOBOL_TABLE[i & 0xff] ^ SOBOL_TABLE[256 + (i >> 8 & 0xff)]
+                ^ SOBOL_TABLE[512 + (i >> 16 & 0xff)]
+                ^ SOBOL_TABLE[768 + (i >> 24)]
+            : __reverse(i);
+        return __owen(x, mix(pair_seed + dim%2 + 1));
+    }
+    static std::uint32_t __reverse(std::uint32_t x) {
+        x = (x << 16) | (x >> 16);
+        x = ((x & 0x00ff00ff) << 8) | ((x & 0xff00ff00) >> 8);
+        x = ((x & 0x0f0f0f0f) << 4) | ((x & 0xf0f0f0f0) >> 4);
+        x = ((x & 0x33333333) << 2) | ((x & 0xcccccccc) >> 2);
+        return ((x & 0x55555555) << 1) | ((x & 0xaaaaaaaa) >> 1);
+    }
+    // Nested uniform scramble via the Laine-Karras permutation.
+    static std::uint32_t __owen(std::uint32_t x, std::uint64_t seed) {
+        x = __reverse(x);
+        x += std::uint32_t(seed);
+        x ^= x * 0x6c50b47cu; x ^= x * 0xb82f1e52u;
+        x ^= x * 0xc7afe638u; x ^= x * 0x8d22f6e6u;
+        return __reverse(x);
+    }
+};
@@ -0,0 +1,292 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "objects.hpp"
+
+
+// Scene description read from a text file, one item per line, where an
+// indented line continues the item above and `#` starts a comment. An
+// item is a kind followed by named fields, a field being a name and its
+// numbers (or, for `texture`, a file name):
+//
+//   camera e X Y Z n X Y Z a X Y Z b X Y Z d PIXEL [size XS YS]
+//   rectangle o X Y Z n X Y Z a X Y Z b X Y Z size A B
+//       prop ABSORB DIFFUSE SPECULAR color B G R radiation B G R
+//   led o .. n .. a .. b .. size A B texture FILE texel SIZE
+//       prop ABSORB DIFFUSE SPECULAR [lod LEVEL]
+//   sphere o X Y Z r RADIUS prop .. color .. radiation ..
+//   waterdrop o X Y Z s SCALE prop .. color .. radiation ..
+//   transparent_sphere o X Y Z r RADIUS prop ABSORB PASS color B G R
+//       index REFRACTIVE_INDEX
+//   transparent_waterdrop o X Y Z s SCALE prop .. color .. index ..
+//
+// The camera's size is the resolution its pixel size d is meant for,
+// 1600 by 1200 if not given. Colours are in BGR order like the textures;
+// `radiation` defaults to black. There must be exactly one camera. A
+// rectangle's n, a and b must be orthonormal, as the intersection test
+// assumes. The objects go straight into the per-type arrays of
+// objects::TypedAll, without a heap allocation each.
+struct SceneFile {
+    objects::TypedAll scene; Camera camera; std::int64_t xs, ys;
+    std::string filename; std::size_t line = 0; bool ok = true;
+
+    SceneFile() = default;
+    SceneFile(const SceneFile &) = delete;
+    bool __error(const std::string &message) {
+        if (ok)
+            std::fprintf(stderr, "%s:%zu: %s\n", filename.c_str(), line,
+                    message.c_str());
+        return ok = false;
+    }
+    struct Fields {
+        std::map<std::string, std::vector<double>> numbers;
+        std::string texture;
+    };
+    bool __number(const std::string &token, double &v) {
+        char *end;
+        v = std::strtod(token.c_str(), &end);
+        return !token.empty() && *end == '\0' && std::isfinite(v);
+    }
+    bool __parse(const std::vector<std::string> &tokens, Fields &fields) {
+        for (std::size_t i=1; i<tokens.size(); ) {
+            const std::string &name = tokens[i++];
+            if (fields.numbers.count(name) || (name == "texture"
+                        && !fields.texture.empty()))
+                return __error("field " + name + " given twice");
+            if (name == "texture") {
+                if (i == tokens.size())
+                    return __error("texture needs a file name");
+                fields.texture = tokens[i++];
+                continue;
+            }
+            auto &values = fields.numbers[name]; double v;
+            for (; i<tokens.size() && __number(tokens[i], v); ++i)
+                values.push_back(v);
+            if (i < tokens.size() && values.empty())
+                return __error("field " + name + " needs numbers, not "
+                        + tokens[i]);
+        }
+        return true;
+    }
+    // Takes field `name` with exactly n numbers; an absent optional field
+    // keeps `fallback`.
+    template<class T> bool __take(Fields &fields, const char *name,
+            std::size_t n, T *out, const T *fallback = nullptr) {
+        auto it = fields.numbers.find(name);
+        if (it == fields.numbers.end()) {
+            if (!fallback)
+                return __error(std::string("missing field ") + name);
+            std::copy(fallback, fallback+n, out);
+            return true;
+        }
+        if (it->second.size() != n)
+            return __error(std::string("field ") + name + " needs "
+                    + std::to_string(n) + " numbers");
+        std::copy(it->second.begin(), it->second.end(), out);
+        fields.numbers.erase(it);
+        return true;
+    }
+    template<class T> bool __take(Fields &fields, const char *name,
+            Eigen::Matrix<T, 3, 1> &v,
+            const Eigen::Matrix<T, 3, 1> *fallback = nullptr) {
+        return __take(fields, name, 3, v.data(),
+                fallback ? fallback->data() : nullptr);
+    }
+    template<std::size_t N> bool __prop(Fields &fields,
+            std::array<double, N> &prop) {
+        if (!__take(fields, "prop", N, prop.data()))
+            return false;
+        double sum = 0.;
+        for (auto p : prop)
+            if (p < 0.)
+                return __error("prop must not be negative");
+            else
+                sum += p;
+        return sum > 0. || __error("prop must not be all zero");
+    }
+    bool __rectangle(Fields &fields, shapes::DefiniteRectangle &r) {
+        double size[2];
+        if (!__take(fields, "o", r.o) || !__take(fields, "n", r.n)
+                || !__take(fields, "a", r.a) || !__take(fields, "b", r.b)
+                || !__take(fields, "size", 2, size))
+            return false;
+        r.am = size[0]; r.bm = size[1];
+        constexpr double TOLERANCE = 1e-6;
+        for (auto *v : {&r.n, &r.a, &r.b})
+            if (std::abs(v->norm() - 1.) > TOLERANCE)
+                return __error("n, a and b must be unit vectors");
+        if (std::abs(r.n.dot(r.a)) > TOLERANCE
+                || std::abs(r.n.dot(r.b)) > TOLERANCE
+                || std::abs(r.a.dot(r.b)) > TOLERANCE)
+            return __error("n, a and b must be orthogonal");
+        return (r.am > 0. && r.bm > 0.) || __error("size must be positive");
+    }
+    template<class Base> bool __solid(Fields &fields, Base &base) {
+        static const Eigen::Vector3d black{0., 0., 0.};
+        return __prop(fields, base._prop)
+            && __take(fields, "color", base._color)
+            && __take(fields, "radiation", base._radiation, &black);
+    }
+    template<class T> bool __transparent(Fields &fields, T &obj) {
+        if (!__prop(fields, obj.prop) || !__take(fields, "color", obj.color)
+                || !__take(fields, "index", 1, &obj.refract_index))
+            return false;
+        return obj.refract_index > 0.
+            || __error("index must be positive");
+    }
+    bool __sphere(Fields &fields, shapes::Sphere &s) {
+        return __take(fields, "o", s.o) && __take(fields, "r", 1, &s.r)
+            && (s.r > 0. || __error("r must be positive"));
+    }
+    bool __waterdrop(Fields &fields, shapes::WaterDrop &w) {
+        return __take(fields, "o", w.o) && __take(fields, "s", 1, &w.s)
+            && (w.s != 0. || __error("s must not be zero"));
+    }
+    // Parses an object of `kind` into the scene's array for its type.
+    bool __object(const std::string &kind, Fields &fields) {
+        if (kind == "rectangle") {
+            objects::DefiniteRectangleSCO obj{};
+            return __rectangle(fields, obj.base) && __solid(fields, obj.base)
+                && __insert(obj);
+        } else if (kind == "led") {
+            objects::LEDSCO obj{};
+            static const double zero = 0.;
+            if (!__rectangle(fields, obj.base)
+                    || !__prop(fields, obj.base._prop)
+                    || !__take(fields, "texel", 1, &obj.base.d)
+                    || !__take(fields, "lod", 1, &obj.base.lod, &zero))
+                return false;
+            if (fields.texture.empty())
+                return __error("missing field texture");
+            if (!(obj.base.d > 0.))
+                return __error("texel must be positive");
+            if (!obj.base.from_file(fields.texture.c_str()))
+                return __error("cannot load " + fields.texture);
+            fields.texture.clear();
+            return __insert(obj);
+        } else if (kind == "sphere") {
+            objects::SphereSCO obj{};
+            return __sphere(fields, obj.base) && __solid(fields, obj.base)
+                && __insert(obj);
+        } else if (kind == "waterdrop") {
+            objects::WaterDropSCO obj{};
+            return __waterdrop(fields, obj.base)
+                && __solid(fields, obj.base) && __insert(obj);
+        } else if (kind == "transparent_sphere") {
+            objects::SphereT obj{};
+            return __sphere(fields, obj.base) && __transparent(fields, obj)
+                && __insert(obj);
+        } else if (kind == "transparent_waterdrop") {
+            objects::WaterDropT obj{};
+            return __waterdrop(fields, obj.base)
+                && __transparent(fields, obj) && __insert(obj);
+        }
+        return __error("unknown kind " + kind);
+    }
+    template<class T> bool __insert(T &obj) {
+        scene.insert(std::move(obj));
+        return true;
+    }
+    bool __camera(Fields &fields) {
+        static const double default_size[2] = {1600., 1200.};
+        double size[2];
+        if (!__take(fields, "e", camera.e) || !__take(fields, "n", camera.n)
+                || !__take(fields, "a", camera.a)
+                || !__take(fields, "b", camera.b)
+                || !__take(fields, "d", 1, &camera.d)
+                || !__take(fields, "size", 2, size, default_size))
+            return false;
+        xs = size[0]; ys = size[1];
+        if (!(camera.d > 0.))
+            return __error("d must be positive");
+        return (xs > 0 && ys > 0 && xs == size[0] && ys == size[1])
+            || __error("size must be positive integers");
+    }
+    // Scales the pixels so that _xs pixels span the width of xs; the
+    // view is kept when the aspect ratio is.
+    void resize(std::int64_t _xs, std::int64_t _ys) {
+        camera.d *= double(xs) / _xs;
+        xs = _xs; ys = _ys;
+    }
+    bool __leftover(const Fields &fields) {
+        if (!fields.texture.empty())
+            return __error("unexpected field texture");
+        if (!fields.numbers.empty())
+            return __error("unexpected field "
+                    + fields.numbers.begin()->first);
+        return true;
+    }
+    // Reads and builds the scene; false, with the first problem and its
+    // line on stderr, if the file cannot be read or is invalid.
+    bool load(const std::string &_filename) {
+        filename = _filename; line = 0; ok = true;
+        std::FILE *file = std::fopen(filename.c_str(), "rb");
+        if (!file) {
+            std::perror(filename.c_str());
+            return ok = false;
+        }
+        std::string text; char buffer[4096]; std::size_t n;
+        while ((n = std::fread(buffer, 1, sizeof(buffer), file)) > 0)
+            text.append(buffer, n);
+        std::fclose(file);
+        // Items as (first line, tokens); indented lines continue the item.
+        std::vector<std::pair<std::size_t, std::vector<std::string>>> items;
+        for (std::size_t begin=0; ok && begin<text.size(); ) {
+            std::size_t end = text.find('\n', begin);
+            if (end == std::string::npos)
+                end = text.size();
+            std::string content = text.substr(begin, end-begin);
+            begin = end + 1; ++line;
+            content = content.substr(0, content.find('#'));
+            std::vector<std::string> tokens;
+            for (std::size_t i=0; i<content.size(); ) {
+                i = content.find_first_not_of(" \t\r", i);
+                if (i == std::string::npos)
+                    break;
+                std::size_t j = content.find_first_of(" \t\r", i);
+                tokens.push_back(content.substr(i, j-i));
+                i = j;
+            }
+            if (tokens.empty())
+                continue;
+            if (content[0] != ' ' && content[0] != '\t')
+                items.push_back({line, {}});
+            else if (items.empty()) {
+                __error("indented line continues nothing");
+                break;
+            }
+            auto &item = items.back().second;
+            item.insert(item.end(), tokens.begin(), tokens.end());
+        }
+        scene.clear(); bool has_camera = false;
+        for (auto &[first, tokens] : items) {
+            Fields fields; line = first;
+            if (!ok || !__parse(tokens, fields))
+                break;
+            if (tokens[0] == "camera") {
+                if (has_camera)
+                    __error("second camera");
+                else if (__camera(fields))
+                    has_camera = true;
+            } else
+                __object(tokens[0], fields);
+            if (ok)
+                __leftover(fields);
+        }
+        if (ok && !has_camera)
+            __error("no camera");
+        if (!ok)
+            return false;
+        scene.build();
+        camera.scene = &scene;
+        return true;
+    }
+};
@@ -5,7 +5,7 @@
 
 namespace scenes {
 namespace threebody {
-inline Scene scene(std::minstd_rand &rng) {
+inline Scene scene() {
     using R = objects::DefiniteRectangleSCO;
     using LED = objects::LEDSCO;
     using ST = objects::SphereT;
@@ -31,32 +31,32 @@ inline Scene scene(std::minstd_rand &rng) {
     front->base.o << 300., 150., 0.; front->base.n << -1., 0., 0.;
     front->base.a << 0., -1., 0.; front->base.b << 0., 0., 1.;
     front->base.am = 300.; front->base.bm = 225.;
-    front->base.from_file("threebody.dat"); front->base.d = 0.15;
+    front->base.from_file("threebody.tex"); front->base.d = 0.15;
     spherel->base.o << 215.1, 84.9, 20.5; spherel->base.r = 20.;
     spherem->base.o << 180., 0., 20.5; spherem->base.r = 20.;
     spherer->base.o << 215.1, -84.9, 20.5; spherer->base.r = 20.;
     waterdropb->base.o << 225., 104., 100.; waterdropb->base.s = -6.;
     waterdropt->base.o << 225., -104., 200.; waterdropt->base.s = 6.;
     bottom->base._prop = {.1, .75, .15}; bottom->base._color << 1., 1., 1.;
-    bottom->base._radiation << 0., 0., 0.; bottom->rng = &rng;
+    bottom->base._radiation << 0., 0., 0.;
     top->base._prop = {.1, .0, .0};
-    top->base._radiation << 24., 24., 18.; top->rng = &rng;
+    top->base._radiation << 24., 24., 18.;
     toptop->base._prop = {.1, .9, .0};
     toptop->base._color << 1./16, 1./16, 1./16;
-    toptop->base._radiation << 0., 0., 0.; toptop->rng = &rng;
-    front->base._prop = {.1, .0, .0}; front->rng = &rng;
+    toptop->base._radiation << 0., 0., 0.;
+    front->base._prop = {.1, .0, .0};
     spherel->prop = {.1, .9}; spherel->color << 1., 1., 1.;
-    spherel->refract_index = 1.6; spherel->rng = &rng;
+    spherel->refract_index = 1.6;
     spherem->prop = {.1, .9}; spherem->color << 1., 1., 1.;
-    spherem->refract_index = 1.6; spherem->rng = &rng;
+    spherem->refract_index = 1.6;
     spherer->prop = {.1, .9}; spherer->color << 1., 1., 1.;
-    spherer->refract_index = 1.6; spherer->rng = &rng;
+    spherer->refract_index = 1.6;
     waterdropb->base._prop = {.1, .0, .9};
     waterdropb->base._color << 1., 1., 1;
-    waterdropb->base._radiation << 0., 0., 0.; waterdropb->rng = &rng;
+    waterdropb->base._radiation << 0., 0., 0.;
     waterdropt->base._prop = {.1, .0, .9};
     waterdropt->base._color << 1., 1., 1;
-    waterdropt->base._radiation << 0., 0., 0.; waterdropt->rng = &rng;
+    waterdropt->base._radiation << 0., 0., 0.;
     Scene s;
     s.push_back(std::move(bottom));
     s.push_back(std::move(front));
@@ -67,31 +67,28 @@ inline Scene scene(std::minstd_rand &rng) {
     s.push_back(std::move(spherer));
     s.push_back(std::move(waterdropb));
     s.push_back(std::move(waterdropt));
+    s.build();
     return s;
 }
-inline Camera camera(std::minstd_rand &rng, Scene &scene) {
+inline Camera camera(Scene &scene) {
     Camera c; c.e << -325., 0., 625.; c.n << 500., 0., -500.;
     c.a << 0., -1., 0.; c.b << 0.707, 0., 0.707; c.d = 3./16;
-    c.rng = &rng; c.scene = &scene;
+    c.scene = &scene;
     return c;
 }
 }
 
 namespace saturn {
-inline Scene scene(std::minstd_rand &rng) {
+// The walls, the ceiling light and the LED screen, without the spheres.
+inline Scene room() {
     using R = objects::DefiniteRectangleSCO;
     using LED = objects::LEDSCO;
-    using SO = objects::SphereSCO;
     auto bottom = std::make_unique<R>();
     auto top = std::make_unique<R>();
     auto light = std::make_unique<R>();
     auto front = std::make_unique<LED>();
-    auto back = std::make_unique<R>();
     auto left = std::make_unique<R>();
     auto right = std::make_unique<R>();
-    auto spherel = std::make_unique<SO>();
-    auto spherem = std::make_unique<SO>();
-    auto spherer = std::make_unique<SO>();
     bottom->base.o << 0., 150., 0.; bottom->base.n << 0., 0., 1.;
     bottom->base.a << 0., -1., 0.; bottom->base.b << 1., 0., 0.;
     bottom->base.am = bottom->base.bm = 300.;
@@ -104,33 +101,24 @@ inline Scene scene(std::minstd_rand &rng) {
     front->base.o << 300., 150., 0.; front->base.n << -1., 0., 0.;
     front->base.a << 0., -1., 0.; front->base.b << 0., 0., 1.;
     front->base.am = 300.; front->base.bm = 225.;
-    front->base.from_file("saturn.dat"); front->base.d = 0.05;
+    front->base.from_file("saturn.tex"); front->base.d = 0.05;
     left->base.o << 0., 150., 0.; left->base.n << 0., -1., 0.;
     left->base.a << 1., 0., 0.; left->base.b << 0., 0., 1.;
     left->base.am = 300.; left->base.bm = 225.;
     right->base.o << 0., -150., 0.; right->base.n << 0., 1., 0.;
     right->base.a << 1., 0., 0.; right->base.b << 0., 0., 1.;
     right->base.am = 300.; right->base.bm = 225.;
-    spherel->base.o << 140.1, 84.9, 20.5; spherel->base.r = 20.;
-    spherem->base.o << 105., 0., 20.5; spherem->base.r = 20.;
-    spherer->base.o << 140.1, -84.9, 20.5; spherer->base.r = 20.;
     bottom->base._prop = {.1, .9, .0}; bottom->base._color << .75, .75, .75;
-    bottom->base._radiation << 0., 0., 0.; bottom->rng = &rng;
+    bottom->base._radiation << 0., 0., 0.;
     top->base._prop = {.1, .9, .0}; top->base._color << .75, .75, .75;
-    top->base._radiation << 0., 0., 0.; top->rng = &rng;
+    top->base._radiation << 0., 0., 0.;
     light->base._prop = {.1, .0, .0};
-    light->base._radiation << 32., 32., 32.; light->rng = &rng;
-    front->base._prop = {.1, .0, .0}; front->rng = &rng;
+    light->base._radiation << 32., 32., 32.;
+    front->base._prop = {.1, .0, .0};
     left->base._prop = {.1, .9, .0}; left->base._color << .25, .25, .75;
-    left->base._radiation << 0., 0., 0.; left->rng = &rng;
+    left->base._radiation << 0., 0., 0.;
     right->base._prop = {.1, .9, .0}; right->base._color << .25, .75, .25;
-    right->base._radiation << 0., 0., 0.; right->rng = &rng;
-    spherel->base._prop = {.1, .9, .0}; spherel->base._color << 1., 1., 1.;
-    spherel->base._radiation << 0., 0., 0.; spherel->rng = &rng;
-    spherem->base._prop = {.1, .45, .45}; spherem->base._color << 1., 1., 1.;
-    spherem->base._radiation << 0., 0., 0.; spherem->rng = &rng;
-    spherer->base._prop = {.1, .0, .9}; spherer->base._color << 1., 1., 1.;
-    spherer->base._radiation << 0., 0., 0.; spherer->rng = &rng;
+    right->base._radiation << 0., 0., 0.;
     Scene s;
     s.push_back(std::move(bottom));
     s.push_back(std::move(top));
@@ -138,15 +126,107 @@ inline Scene scene(std::minstd_rand &rng) {
     s.push_back(std::move(front));
     s.push_back(std::move(left));
     s.push_back(std::move(right));
+    return s;
+}
+inline Scene scene() {
+    using SO = objects::SphereSCO;
+    auto spherel = std::make_unique<SO>();
+    auto spherem = std::make_unique<SO>();
+    auto spherer = std::make_unique<SO>();
+    spherel->base.o << 140.1, 84.9, 20.5; spherel->base.r = 20.;
+    spherem->base.o << 105., 0., 20.5; spherem->base.r = 20.;
+    spherer->base.o << 140.1, -84.9, 20.5; spherer->base.r = 20.;
+    spherel->base._prop = {.1, .9, .0}; spherel->base._color << 1., 1., 1.;
+    spherel->base._radiation << 0., 0., 0.;
+    spherem->base._prop = {.1, .45, .45}; spherem->base._color << 1., 1., 1.;
+    spherem->base._radiation << 0., 0., 0.;
+    spherer->base._prop = {.1, .0, .9}; spherer->base._color << 1., 1., 1.;
+    spherer->base._radiation << 0., 0., 0.;
+    Scene s = room();
     s.push_back(std::move(spherel));
     s.push_back(std::move(spherem));
     s.push_back(std::move(spherer));
+    s.build();
     return s;
 }
-inline Camera camera(std::minstd_rand &rng, Scene &scene) {
+inline Camera camera(Scene &scene) {
     Camera c; c.e << -600., 0., 112.5; c.n << 600.5, 0., 0.;
     c.a << 0., -1., 0.; c.b << 0., 0., 1.; c.d = 3./16;
-    c.rng = &rng; c.scene = &scene;
+    c.scene = &scene;
+    return c;
+}
+}
+
+// saturn with glass spheres on either side of a mirror sphere, to show
+// caustics.
+namespace saturn2 {
+inline Scene scene() {
+    using SO = objects::SphereSCO;
+    using ST = objects::SphereT;
+    auto spherel = std::make_unique<ST>();
+    auto spherem = std::make_unique<SO>();
+    auto spherer = std::make_unique<ST>();
+    spherel->base.o << 140.1, 84.9, 20.5; spherel->base.r = 20.;
+    spherem->base.o << 105., 0., 20.5; spherem->base.r = 20.;
+    spherer->base.o << 140.1, -84.9, 20.5; spherer->base.r = 20.;
+    spherel->prop = {.1, .9}; spherel->color << 1., 1., 1.;
+    spherel->refract_index = 1.5;
+    spherem->base._prop = {.1, .0, .9}; spherem->base._color << 1., 1., 1.;
+    spherem->base._radiation << 0., 0., 0.;
+    spherer->prop = {.1, .9}; spherer->color << 1., 1., 1.;
+    spherer->refract_index = 1.5;
+    Scene s = saturn::room();
+    s.push_back(std::move(spherel));
+    s.push_back(std::move(spherem));
+    s.push_back(std::move(spherer));
+    s.build();
+    return s;
+}
+inline Camera camera(Scene &scene) { return saturn::camera(scene); }
+}
+
+namespace drops {
+// n mirror water drops of random size and orientation scattered over a
+// diffuse floor lit from above; for measuring scaling with scene size.
+inline Scene scene(std::size_t n, std::uint64_t seed) {
+    using R = objects::DefiniteRectangleSCO;
+    using WO = objects::WaterDropSCO;
+    using uniform = std::uniform_real_distribution<>;
+    CounterRng rng{CounterRng::mix(seed), 0};
+    auto bottom = std::make_unique<R>();
+    auto top = std::make_unique<R>();
+    bottom->base.o << 0., 500., 0.; bottom->base.n << 0., 0., 1.;
+    bottom->base.a << 0., -1., 0.; bottom->base.b << 1., 0., 0.;
+    bottom->base.am = bottom->base.bm = 1000.;
+    top->base.o << 250., 250., 400.; top->base.n << 0., 0., 1.;
+    top->base.a << 0., -1., 0.; top->base.b << 1., 0., 0.;
+    top->base.am = top->base.bm = 500.;
+    bottom->base._prop = {.1, .9, .0}; bottom->base._color << .75, .75, .75;
+    bottom->base._radiation << 0., 0., 0.;
+    top->base._prop = {.1, .0, .0};
+    top->base._radiation << 16., 16., 16.;
+    Scene s;
+    s.push_back(std::move(bottom));
+    s.push_back(std::move(top));
+    for (std::size_t i=0; i<n; ++i) {
+        auto drop = std::make_unique<WO>();
+        double size = uniform(2., 8.)(rng);
+        drop->base.o << uniform(0., 1000.)(rng), uniform(-500., 500.)(rng),
+            uniform(0., 300.)(rng);
+        drop->base.s = uniform(0., 1.)(rng) < .5 ? -size : size;
+        drop->base._prop = {.1, .2, .7};
+        drop->base._color << uniform(.5, 1.)(rng), uniform(.5, 1.)(rng),
+            uniform(.5, 1.)(rng);
+        drop->base._radiation << 0., 0., 0.;
+        s.push_back(std::move(drop));
+    }
+    s.build();
+    return s;
+}
+inline Camera camera(Scene &scene) {
+    Camera c; c.e << -600., 0., 300.; c.n << 600., 0., -150.;
+    c.a << 0., -1., 0.; c.b << .242, 0., .970; c.d = 3./16;
+    c.scene = &scene;
     return c;
 }
 }
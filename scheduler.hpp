@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+
+inline int thread_count() {
+#ifdef _OPENMP
+    return omp_get_num_threads();
+#else
+    return 1;
+#endif
+}
+inline int thread_index() {
+#ifdef _OPENMP
+    return omp_get_thread_num();
+#else
+    return 0;
+#endif
+}
+
+// Hands out task indices [0, n) to a fixed set of threads. Each thread
+// starts with a contiguous block, takes from the front of its own block
+// and, once that is empty, steals single tasks from the back of the
+// others'. Tasks never spawn new ones, so a block is a locked range.
+struct WorkStealingScheduler {
+    struct alignas(64) Block {
+        std::mutex mutex; std::int64_t head, tail;
+    };
+    std::unique_ptr<Block[]> blocks; int threads = 0, capacity = 0;
+    void reset(int _threads, std::int64_t n) {
+        if (_threads > capacity) {
+            blocks.reset(new Block[_threads]);
+            capacity = _threads;
+        }
+        threads = _threads;
+        for (int i=0; i<threads; ++i) {
+            blocks[i].head = n * i / threads;
+            blocks[i].tail = n * (i+1) / threads;
+        }
+    }
+    bool pop(int self, std::int64_t &task) {
+        {
+            std::lock_guard<std::mutex> lock(blocks[self].mutex);
+            if (blocks[self].head < blocks[self].tail) {
+                task = blocks[self].head++;
+                return true;
+            }
+        }
+        for (int i=1; i<threads; ++i) {
+            Block &victim = blocks[(self+i) % threads];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (victim.head < victim.tail) {
+                task = --victim.tail;
+                return true;
+            }
+        }
+        return false;
+    }
+};
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+// Work queue of a sharded render kept in a directory that every process
+// can reach. Shard k is claimed by creating k.lock exclusively, kept alive
+// by touching it and finished by creating k.done. A lock nobody touched for
+// `timeout` seconds is taken to belong to a dead worker: reap() removes it
+// and the shard is claimed again, resuming from its checkpoint. A worker
+// that finds its lock gone or taken over drops the shard. Since a shard's
+// passes are fixed, two workers briefly rendering it produce the same
+// samples, so a wrong guess costs only time.
+struct ShardDirectory {
+    std::string path; std::int64_t shards; double timeout; std::string owner;
+
+    ShardDirectory(std::string _path, std::int64_t _shards, double _timeout)
+            : path(std::move(_path)), shards(_shards), timeout(_timeout) {
+        char host[256] = {};
+        ::gethostname(host, sizeof(host) - 1);
+        owner = std::string(host) + ":" + std::to_string(::getpid());
+    }
+    std::string file(std::int64_t k, const char *suffix) const {
+        return path + "/" + std::to_string(k) + suffix;
+    }
+    static bool __exists(const std::string &name) {
+        struct stat st;
+        return ::stat(name.c_str(), &st) == 0;
+    }
+    std::string __holder(std::int64_t k) const {
+        char buffer[512] = {};
+        std::FILE *lock = std::fopen(file(k, ".lock").c_str(), "rb");
+        if (!lock)
+            return {};
+        std::size_t n = std::fread(buffer, 1, sizeof(buffer) - 1, lock);
+        std::fclose(lock);
+        return std::string(buffer, n);
+    }
+    // Returns an unfinished, unclaimed shard now owned by this process, or
+    // -1 if there is none at the moment.
+    std::int64_t claim() {
+        for (std::int64_t k=0; k<shards; ++k) {
+            if (__exists(file(k, ".done")))
+                continue;
+            int fd = ::open(file(k, ".lock").c_str(),
+                    O_WRONLY | O_CREAT | O_EXCL, 0644);
+            if (fd < 0)
+                continue;
+            bool written = ::write(fd, owner.data(), owner.size())
+                == ssize_t(owner.size());
+            ::close(fd);
+            if (written && !__exists(file(k, ".done")))
+                return k;
+            ::unlink(file(k, ".lock").c_str());
+        }
+        return -1;
+    }
+    // Refreshes the lock; false if this process no longer owns the shard.
+    bool heartbeat(std::int64_t k) {
+        return __holder(k) == owner
+            && ::utimensat(AT_FDCWD, file(k, ".lock").c_str(),
+                    nullptr, 0) == 0;
+    }
+    bool finish(std::int64_t k) {
+        if (__holder(k) != owner)
+            return false;
+        int fd = ::open(file(k, ".done").c_str(), O_WRONLY | O_CREAT, 0644);
+        if (fd < 0)
+            return false;
+        ::close(fd);
+        ::unlink(file(k, ".lock").c_str());
+        return true;
+    }
+    void release(std::int64_t k) {
+        if (__holder(k) == owner)
+            ::unlink(file(k, ".lock").c_str());
+    }
+    // Removes the locks of unfinished shards whose owners stopped touching
+    // them; returns how many were freed.
+    std::int64_t reap() {
+        std::int64_t freed = 0;
+        auto now = std::chrono::system_clock::now().time_since_epoch();
+        double seconds = std::chrono::duration<double>(now).count();
+        for (std::int64_t k=0; k<shards; ++k) {
+            struct stat st;
+            if (__exists(file(k, ".done"))
+                    || ::stat(file(k, ".lock").c_str(), &st) != 0)
+                continue;
+            double touched = st.st_mtim.tv_sec + st.st_mtim.tv_nsec*1e-9;
+            if (seconds - touched > timeout
+                    && ::unlink(file(k, ".lock").c_str()) == 0)
+                ++freed;
+        }
+        return freed;
+    }
+    bool finished() const {
+        for (std::int64_t k=0; k<shards; ++k)
+            if (!__exists(file(k, ".done")))
+                return false;
+        return true;
+    }
+};
@@ -0,0 +1,262 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "objects.hpp"
+
+
+// Uniform grid over points, hashed into a table of cells; a point is
+// stored once and found by scanning the 3x3x3 cells around a query, so
+// queries must not reach further than the cell size.
+struct HashGrid {
+    double cell; std::vector<std::uint32_t> start, index;
+    std::uint64_t __hash(
+            std::int64_t x, std::int64_t y, std::int64_t z) const {
+        std::uint64_t h = x*73856093ll ^ y*19349663ll ^ z*83492791ll;
+        return CounterRng::mix(h) & (start.size() - 2);
+    }
+    std::int64_t __coord(double v) const { return std::floor(v / cell); }
+    template<class F> void build(std::size_t n, double _cell, F &&position) {
+        std::size_t size = 2;
+        while (size < 2*n + 2)
+            size *= 2;
+        cell = _cell; start.assign(size + 1, 0); index.resize(n);
+        std::vector<std::uint64_t> key(n);
+        for (std::size_t i=0; i<n; ++i) {
+            Vector3 p = position(i);
+            key[i] = __hash(__coord(p.x()), __coord(p.y()), __coord(p.z()));
+            ++start[key[i] + 1];
+        }
+        for (std::size_t i=1; i<start.size(); ++i)
+            start[i] += start[i-1];
+        std::vector<std::uint32_t> fill(start.begin(), start.end()-1);
+        for (std::size_t i=0; i<n; ++i)
+            index[fill[key[i]]++] = i;
+    }
+    // Calls f(i) for every point in the cells around p's, plus whatever
+    // shares their slots; f filters by distance itself. Each slot is
+    // visited once even if several of the 27 cells hash to it.
+    template<class F> void query(const Vector3 &p, F &&f) const {
+        std::int64_t cx = __coord(p.x()), cy = __coord(p.y()),
+                     cz = __coord(p.z());
+        std::uint64_t seen[27]; int n_seen = 0;
+        for (int dx=-1; dx<=1; ++dx)
+            for (int dy=-1; dy<=1; ++dy)
+                for (int dz=-1; dz<=1; ++dz) {
+                    std::uint64_t h = __hash(cx+dx, cy+dy, cz+dz);
+                    bool dup = false;
+                    for (int i=0; i<n_seen; ++i)
+                        dup |= seen[i] == h;
+                    if (dup)
+                        continue;
+                    seen[n_seen++] = h;
+                    for (auto i=start[h]; i<start[h+1]; ++i)
+                        f(index[i]);
+                }
+    }
+};
+
+// Stochastic progressive photon mapping (Hachisuka and Jensen, 2009), an
+// alternative to path tracing for caustics seen on diffuse surfaces, such
+// as the light focused by the glass spheres of saturn2. Each pass traces
+// camera paths through specular events to a visible point per pixel,
+// traces photons from the lights through every event, stores them in a
+// hash grid and gathers them at the visible points, shrinking each pixel's
+// radius as its photon count grows.
+//
+// capture() writes the current estimate into a Screen in the usual sum and
+// count form and reports every tile to its tile_done, so a Preview follows
+// it; it stops early, after a whole pass, once the screen is interrupted.
+// There are no variance estimates, so the screen never converges. The
+// per-pixel radii and fluxes are not saved: a resumed run starts a new
+// estimate and averages it with the stored image, weighting each tile by
+// the samples it already has.
+struct PhotonMapper {
+    struct VisiblePoint {
+        Vector3 p, n; Eigen::Vector3d beta; bool valid;
+    };
+    struct Pixel {
+        double n, r2; Eigen::Vector3d tau, direct;
+    };
+    struct Photon {
+        Vector3 p, d; Eigen::Vector3d flux;
+    };
+    static constexpr double ALPHA = 2./3;
+    static constexpr int MAX_DEPTH = 64;
+    static constexpr std::int64_t CHUNK = 256;
+    Camera *camera; std::int64_t photons_per_pass = 0;
+    double initial_radius = 0.;
+    std::vector<Pixel> pixels; std::vector<VisiblePoint> points;
+    std::vector<Photon> photons; std::vector<std::vector<Photon>> chunks;
+    std::vector<Eigen::Vector3d> base; std::vector<std::int64_t> base_samples;
+    std::int64_t passes = 0, emitted = 0, base_count = 0;
+    HashGrid grid;
+
+    void __start(Screen &screen) {
+        Scene &scene = *camera->scene;
+        if (initial_radius <= 0.) {
+            Aabb box = scene.bounds();
+            initial_radius = box.lo.x() <= box.hi.x()
+                ? (box.hi - box.lo).norm() * 2e-3 : 1.;
+        }
+        if (photons_per_pass <= 0)
+            photons_per_pass = screen.xs * screen.ys;
+        pixels.assign(screen.xs*screen.ys, {0., initial_radius*initial_radius,
+                {0., 0., 0.}, {0., 0., 0.}});
+        points.resize(pixels.size());
+        base.resize(pixels.size()); base_count = screen.count;
+        base_samples = screen.samples;
+        for (std::int64_t y=0; y<screen.ys; ++y)
+            for (std::int64_t x=0; x<screen.xs; ++x)
+                base[y*screen.xs+x] = screen(x, y);
+        passes = emitted = 0;
+    }
+    void capture(Screen &screen, std::uint64_t seed, std::int64_t n = 1) {
+        if (pixels.size() != std::size_t(screen.xs*screen.ys) || !passes)
+            __start(screen);
+        for (std::int64_t i=0; i<n && !screen.__interrupted(); ++i) {
+            trace_camera(screen, seed);
+            trace_photons(seed);
+            gather();
+            ++passes;
+        }
+        if (passes)
+            write(screen);
+    }
+    void trace_camera(Screen &screen, std::uint64_t seed) {
+        Scene &scene = *camera->scene;
+        std::int64_t xs = screen.xs, ys = screen.ys;
+#pragma omp parallel for schedule(dynamic, 64)
+        for (std::int64_t i=0; i<xs*ys; ++i) {
+            std::int64_t x = i % xs, y = i / xs;
+            auto rng = CounterRng::for_path(seed, i, base_count + passes,
+                    screen.sequence);
+            Ray ray = camera->ray(x-xs/2, ys/2-y, rng);
+            Eigen::Vector3d beta{1., 1., 1.};
+            VisiblePoint &vp = points[i]; vp.valid = false;
+            for (int depth=0; depth<MAX_DEPTH; ++depth) {
+                Real t; Object *hit = scene.intersects_with(ray, t);
+                if (!hit)
+                    break;
+                Eigen::Vector3d radiation, color; Bounce bounce;
+                Ray ray_new{ray.o+t*ray.d, ray.d}; rng.next_bounce();
+                bool alive = hit->transmit(
+                        radiation, color, ray_new, rng, bounce);
+                pixels[i].direct += (beta.array()*radiation.array()).matrix();
+                if (!alive)
+                    break;
+                beta = (beta.array()*color.array()).matrix();
+                if (bounce.diffuse) {
+                    vp = {ray_new.o, bounce.n, beta, true};
+                    break;
+                }
+                ray = ray_new;
+            }
+        }
+    }
+    // Emits from a point sampled by power and area on a light, in a cosine
+    // distribution about a randomly chosen side, since lights emit on both.
+    // Photon paths are traced in chunks of CHUNK, each into its own buffer,
+    // and the buffers joined in order, so that the photons, and with them
+    // the sums in gather(), do not depend on the number of threads.
+    void trace_photons(std::uint64_t seed) {
+        using boost::math::constants::pi;
+        using uniform = std::uniform_real_distribution<>;
+        Scene &scene = *camera->scene;
+        photons.clear();
+        if (scene.emitters.empty())
+            return;
+        std::int64_t n_chunks = (photons_per_pass + CHUNK-1) / CHUNK;
+        chunks.resize(n_chunks);
+#pragma omp parallel for schedule(dynamic)
+        for (std::int64_t c=0; c<n_chunks; ++c) {
+            std::vector<Photon> &local = chunks[c]; local.clear();
+            std::int64_t end = std::min((c+1)*CHUNK, photons_per_pass);
+            for (std::int64_t k=c*CHUNK; k<end; ++k) {
+                auto rng = CounterRng::for_path(
+                        ~seed, k, base_count + passes);
+                double u = uniform(0., 1.)(rng);
+                std::size_t i = std::upper_bound(scene.emitter_cdf.begin(),
+                        scene.emitter_cdf.end(), u)
+                    - scene.emitter_cdf.begin();
+                Object *light = scene.emitters[
+                    std::min(i, scene.emitters.size()-1)];
+                Real su = uniform(0., 1.)(rng), sv = uniform(0., 1.)(rng);
+                Vector3 q = light->sample_surface(su, sv);
+                Vector3 n = light->normal({q, {0., 0., 0.}});
+                if (uniform(0., 1.)(rng) < .5)
+                    n *= -1.;
+                Eigen::Vector3d flux = light->emission(q)
+                    * (2*pi<double>() / light->emitter_pdf);
+                Vector3 d = RayTransformer{n, n}.diffuse_reflect(rng);
+                Ray ray{offset(q, n, d), d};
+                for (int depth=0; depth<MAX_DEPTH; ++depth) {
+                    Real t; Object *hit = scene.intersects_with(ray, t);
+                    if (!hit)
+                        break;
+                    Ray ray_new{ray.o+t*ray.d, ray.d}; rng.next_bounce();
+                    if (hit->diffuse())
+                        local.push_back({ray_new.o, ray.d, flux});
+                    Eigen::Vector3d radiation, color; Bounce bounce;
+                    if (!hit->transmit(radiation, color, ray_new, rng, bounce))
+                        break;
+                    flux = (flux.array()*color.array()).matrix();
+                    ray = ray_new;
+                }
+            }
+        }
+        for (auto &chunk : chunks)
+            photons.insert(photons.end(), chunk.begin(), chunk.end());
+        emitted += photons_per_pass;
+    }
+    void gather() {
+        using boost::math::constants::pi;
+        double r_max = 0.;
+        for (auto &px : pixels)
+            r_max = std::max(r_max, px.r2);
+        grid.build(photons.size(), std::sqrt(r_max),
+                [&](std::size_t i) { return photons[i].p; });
+#pragma omp parallel for schedule(dynamic, 64)
+        for (std::size_t i=0; i<pixels.size(); ++i) {
+            if (!points[i].valid)
+                continue;
+            VisiblePoint &vp = points[i]; Pixel &px = pixels[i];
+            Eigen::Vector3d phi{0., 0., 0.}; double m = 0.;
+            grid.query(vp.p, [&](std::uint32_t j) {
+                const Photon &ph = photons[j];
+                if ((ph.p - vp.p).squaredNorm() > px.r2
+                        || ph.d.dot(vp.n) >= 0.)
+                    return;
+                phi += ph.flux; ++m;
+            });
+            if (m == 0.)
+                continue;
+            double n_new = px.n + ALPHA*m;
+            double scale = n_new / (px.n + m);
+            px.tau = (px.tau + (vp.beta.array()*phi.array()).matrix()
+                / pi<double>()) * scale;
+            px.r2 *= scale; px.n = n_new;
+        }
+    }
+    void write(Screen &screen) {
+        using boost::math::constants::pi;
+        for (std::int64_t y=0; y<screen.ys; ++y)
+            for (std::int64_t x=0; x<screen.xs; ++x) {
+                Pixel &px = pixels[y*screen.xs+x];
+                Eigen::Vector3d radiance = px.direct / passes
+                    + px.tau / (emitted * pi<double>() * px.r2);
+                screen(x, y) = base[y*screen.xs+x] + radiance*passes;
+            }
+        screen.count = base_count + passes;
+        for (std::size_t k=0; k<screen.samples.size(); ++k)
+            screen.samples[k] = base_samples[k] + passes;
+        std::fill(screen.moment_samples.begin(),
+                screen.moment_samples.end(), 0);
+        std::fill(screen.moment.begin(), screen.moment.end(), 0.);
+        for (std::int64_t k=0; screen.tile_done && k<screen.xt*screen.yt; ++k)
+            screen.tile_done(screen, k);
+    }
+};
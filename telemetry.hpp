@@ -0,0 +1,198 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <vector>
+
+
+// Render statistics, compiled in only with -DWD_TELEMETRY. Each thread
+// counts into its own block, registered on the thread's first event and
+// kept after it exits; collect() sums the blocks when a report is made.
+// Without the flag TELEMETRY is false, every hook below is empty and no
+// block is ever allocated.
+#ifdef WD_TELEMETRY
+constexpr bool TELEMETRY = true;
+#else
+constexpr bool TELEMETRY = false;
+#endif
+
+namespace telemetry {
+
+// Objects past MAX_OBJECTS share the last slot; paths of MAX_LENGTH hits
+// or more share the last histogram bin.
+constexpr std::size_t MAX_OBJECTS = 256, MAX_LENGTH = 32;
+
+// Written only by its own thread, so a relaxed load and store is a plain
+// add; reports read it concurrently.
+struct Counter {
+    std::atomic<std::uint64_t> value{0};
+    void operator+=(std::uint64_t n) {
+        value.store(value.load(std::memory_order_relaxed) + n,
+                std::memory_order_relaxed);
+    }
+    operator std::uint64_t() const {
+        return value.load(std::memory_order_relaxed);
+    }
+};
+
+// Camera rays, continuation rays after a bounce and shadow rays to
+// lights; paths by number of surface hits, and those that ended absorbed
+// (Russian roulette) rather than escaping; intersection tests and hits
+// (any t > 0, every lane of a packet test) per Object::id; passes rendered
+// by Screen::capture() and their wall time.
+template<class T> struct Counts {
+    T primary, secondary, shadow, roulette, escaped, passes, nanoseconds;
+    std::array<T, MAX_LENGTH> length; std::array<T, MAX_OBJECTS> tests, hits;
+
+    template<class U, class F> void __each(const Counts<U> &other, F f) {
+        f(primary, other.primary); f(secondary, other.secondary);
+        f(shadow, other.shadow); f(roulette, other.roulette);
+        f(escaped, other.escaped); f(passes, other.passes);
+        f(nanoseconds, other.nanoseconds);
+        for (std::size_t i=0; i<MAX_LENGTH; ++i)
+            f(length[i], other.length[i]);
+        for (std::size_t i=0; i<MAX_OBJECTS; ++i) {
+            f(tests[i], other.tests[i]); f(hits[i], other.hits[i]);
+        }
+    }
+    template<class U> Counts &operator+=(const Counts<U> &other) {
+        __each(other, [](T &a, std::uint64_t b) { a += b; });
+        return *this;
+    }
+    template<class U> Counts &operator-=(const Counts<U> &other) {
+        __each(other, [](T &a, std::uint64_t b) { a -= b; });
+        return *this;
+    }
+};
+using Snapshot = Counts<std::uint64_t>;
+
+struct Registry {
+    std::mutex mutex; std::vector<std::unique_ptr<Counts<Counter>>> threads;
+};
+inline Registry &registry() {
+    static Registry r;
+    return r;
+}
+inline Counts<Counter> &local() {
+    thread_local Counts<Counter> *counts = [] {
+        std::lock_guard<std::mutex> lock(registry().mutex);
+        registry().threads.push_back(std::make_unique<Counts<Counter>>());
+        return registry().threads.back().get();
+    }();
+    return *counts;
+}
+// Totals over all threads so far; subtract an earlier snapshot for rates.
+inline Snapshot collect() {
+    Snapshot total{};
+    std::lock_guard<std::mutex> lock(registry().mutex);
+    for (auto &counts : registry().threads)
+        total += *counts;
+    return total;
+}
+
+inline void primary_ray() {
+    if constexpr (TELEMETRY)
+        local().primary += 1;
+}
+inline void secondary_ray() {
+    if constexpr (TELEMETRY)
+        local().secondary += 1;
+}
+inline void shadow_ray() {
+    if constexpr (TELEMETRY)
+        local().shadow += 1;
+}
+// A camera path ended after `hits` surface interactions.
+inline void path_end(std::uint64_t hits, bool absorbed) {
+    if constexpr (TELEMETRY) {
+        auto &counts = local();
+        counts.length[std::min<std::uint64_t>(hits, MAX_LENGTH-1)] += 1;
+        if (absorbed)
+            counts.roulette += 1;
+        else
+            counts.escaped += 1;
+    }
+}
+inline void test(std::size_t id, double t) {
+    if constexpr (TELEMETRY) {
+        auto &counts = local(); id = std::min(id, MAX_OBJECTS-1);
+        counts.tests[id] += 1; counts.hits[id] += t > 0.;
+    }
+}
+template<class T, int W> void test(std::size_t id, const T (&t)[W]) {
+    if constexpr (TELEMETRY) {
+        auto &counts = local(); id = std::min(id, MAX_OBJECTS-1);
+        std::uint64_t hits = 0;
+        for (int i=0; i<W; ++i)
+            hits += t[i] > 0.;
+        counts.tests[id] += W; counts.hits[id] += hits;
+    }
+}
+// Start of a timed section; a dummy when disabled.
+inline std::chrono::steady_clock::time_point start() {
+    if constexpr (TELEMETRY)
+        return std::chrono::steady_clock::now();
+    else
+        return {};
+}
+inline void passes(std::int64_t n, std::chrono::steady_clock::time_point t0) {
+    if constexpr (TELEMETRY) {
+        auto &counts = local(); counts.passes += n;
+        counts.nanoseconds += std::chrono::duration_cast<
+            std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0)
+            .count();
+    }
+}
+
+// Prints the counts of `seconds` of rendering, with the scene's objects
+// named by material and centre, busiest first.
+template<class Scene> void report(std::FILE *file, const Snapshot &counts,
+        double seconds, Scene &scene) {
+    static const char *const MATERIALS[] = {"opaque", "transparent", "led"};
+    std::uint64_t paths = counts.roulette + counts.escaped, hits = 0;
+    for (std::size_t i=0; i<MAX_LENGTH; ++i)
+        hits += i * counts.length[i];
+    std::fprintf(file, "telemetry: %.1f s, %.3g paths/s, rays/s: %.3g "
+        "primary, %.3g secondary, %.3g shadow; %.3g s/pass\n", seconds,
+        paths/seconds, counts.primary/seconds, counts.secondary/seconds,
+        counts.shadow/seconds, counts.passes ? counts.nanoseconds*1e-9
+        / counts.passes : 0.);
+    std::fprintf(file, "  paths: mean length %.2f, absorbed %.1f%%, "
+        "escaped %.1f%%; by length:", paths ? double(hits)/paths : 0.,
+        paths ? 100.*counts.roulette/paths : 0.,
+        paths ? 100.*counts.escaped/paths : 0.);
+    for (std::size_t i=0; i<MAX_LENGTH; ++i)
+        if (counts.length[i])
+            std::fprintf(file, " %zu%s: %.2f%%", i,
+                i == MAX_LENGTH-1 ? "+" : "", 100.*counts.length[i]/paths);
+    std::fprintf(file, "\n");
+    using Object = std::remove_reference_t<decltype(*scene[0])>;
+    std::vector<Object *> objects(MAX_OBJECTS);
+    scene.for_each_object([&](Object &obj) {
+        if (obj.id < MAX_OBJECTS)
+            objects[obj.id] = &obj;
+    });
+    std::vector<std::size_t> order;
+    for (std::size_t i=0; i<MAX_OBJECTS; ++i)
+        if (counts.tests[i] && objects[i])
+            order.push_back(i);
+    std::sort(order.begin(), order.end(), [&](std::size_t i, std::size_t j) {
+        return counts.tests[i] > counts.tests[j];
+    });
+    for (auto i : order) {
+        auto c = objects[i]->bounds().center();
+        std::fprintf(file, "  object %zu%s %s (%.1f, %.1f, %.1f): %.3g "
+            "tests/s, %.1f%% hit\n", i, i == MAX_OBJECTS-1 ? "+" : "",
+            MATERIALS[int(objects[i]->material())], c.x(), c.y(), c.z(),
+            counts.tests[i]/seconds, 100.*counts.hits[i]/counts.tests[i]);
+    }
+}
+
+}
@@ -0,0 +1,99 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <jpeglib.h>
+#include <png.h>
+
+#include "texture.hpp"
+
+
+// Converts an image into the texture format of texture.hpp:
+//   texconv IN OUT
+// IN is a JPEG, a PNG or a .dat written by the former png2data.py. 8-bit
+// values are divided by 255 without a transfer curve, as png2data.py did.
+// Build with -ljpeg -lpng.
+
+bool read_jpeg(const char *filename, std::int64_t &xs, std::int64_t &ys,
+        std::vector<Eigen::Vector3d> &pixels) {
+    std::FILE *file = std::fopen(filename, "rb");
+    if (!file)
+        return false;
+    // The default error handler reports and exits, which suits a tool.
+    jpeg_decompress_struct info; jpeg_error_mgr error;
+    info.err = jpeg_std_error(&error);
+    jpeg_create_decompress(&info);
+    jpeg_stdio_src(&info, file);
+    jpeg_read_header(&info, TRUE);
+    info.out_color_space = JCS_RGB;
+    jpeg_start_decompress(&info);
+    xs = info.output_width; ys = info.output_height; pixels.resize(xs*ys);
+    std::vector<JSAMPLE> row(xs*3);
+    for (std::int64_t y=0; y<ys; ++y) {
+        JSAMPROW rows[1] = {row.data()};
+        jpeg_read_scanlines(&info, rows, 1);
+        for (std::int64_t x=0; x<xs; ++x)
+            pixels[y*xs+x] = Eigen::Vector3d{double(row[x*3+2]),
+                double(row[x*3+1]), double(row[x*3])} / 255.;
+    }
+    jpeg_finish_decompress(&info);
+    jpeg_destroy_decompress(&info);
+    std::fclose(file);
+    return true;
+}
+
+bool read_png(const char *filename, std::int64_t &xs, std::int64_t &ys,
+        std::vector<Eigen::Vector3d> &pixels) {
+    png_image image; std::memset(&image, 0, sizeof(image));
+    image.version = PNG_IMAGE_VERSION;
+    if (!png_image_begin_read_from_file(&image, filename))
+        return false;
+    image.format = PNG_FORMAT_BGR;
+    std::vector<png_byte> buffer(PNG_IMAGE_SIZE(image));
+    if (!png_image_finish_read(&image, nullptr, buffer.data(), 0, nullptr))
+        return false;
+    xs = image.width; ys = image.height; pixels.resize(xs*ys);
+    for (std::int64_t i=0; i<xs*ys; ++i)
+        pixels[i] = Eigen::Vector3d{double(buffer[i*3]),
+            double(buffer[i*3+1]), double(buffer[i*3+2])} / 255.;
+    return true;
+}
+
+// xs and ys as int64, then row-major BGR float64 texels.
+bool read_dat(const char *filename, std::int64_t &xs, std::int64_t &ys,
+        std::vector<Eigen::Vector3d> &pixels) {
+    std::FILE *file = std::fopen(filename, "rb");
+    if (!file)
+        return false;
+    bool done = std::fread(&xs, 8, 1, file) == 1
+        && std::fread(&ys, 8, 1, file) == 1 && xs > 0 && ys > 0;
+    if (done) {
+        pixels.resize(xs*ys);
+        done = std::fread(pixels.data(), sizeof(Eigen::Vector3d), xs*ys,
+                file) == std::size_t(xs*ys);
+    }
+    std::fclose(file);
+    return done;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        std::fprintf(stderr, "usage: %s IN.{jpg,png,dat} OUT.tex\n", argv[0]);
+        return 2;
+    }
+    std::string in = argv[1], ext = in.substr(in.rfind('.') + 1);
+    std::int64_t xs, ys; std::vector<Eigen::Vector3d> pixels;
+    auto read = ext == "jpg" || ext == "jpeg" ? read_jpeg
+        : ext == "png" ? read_png : read_dat;
+    if (!read(argv[1], xs, ys, pixels)) {
+        std::fprintf(stderr, "%s: cannot read\n", argv[1]);
+        return 1;
+    }
+    if (!Texture::write(argv[2], xs, ys, std::move(pixels))) {
+        std::perror(argv[2]);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,181 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <Eigen/Core>
+
+
+// Read-only texture memory-mapped from a file written by Texture::write()
+// (see texconv.cpp). The file holds a 64-byte header and then the mip
+// chain from full size down to 1x1, each level ceil(n/2) of the one above
+// and a 2x2 box filter of it. Texels are three float32 in BGR order,
+// stored in TILE x TILE blocks (row-major within a block and across
+// blocks) so that a bilinear lookup touches one or two cache-line runs.
+// Copies share the mapping, which the page cache also shares between
+// processes.
+struct Texture {
+    static constexpr char MAGIC[8] = {'W', 'D', 'T', 'E', 'X', 'T', 'U', 'R'};
+    static constexpr std::uint64_t VERSION = 1;
+    static constexpr std::int64_t TILE = 8;
+    struct Header {
+        char magic[8]; std::uint64_t version;
+        std::int64_t xs, ys, levels, tile, reserved[2];
+    };
+    static_assert(sizeof(Header) == 64);
+    struct Level {
+        std::int64_t xs, ys, xt; const float *texels;
+        static std::size_t __size(std::int64_t xs, std::int64_t ys) {
+            return ((xs+TILE-1) / TILE) * ((ys+TILE-1) / TILE)
+                * TILE*TILE * 3;
+        }
+        static std::size_t __index(std::int64_t x, std::int64_t y,
+                std::int64_t xt) {
+            return (((y/TILE)*xt + x/TILE)*TILE*TILE
+                + (y%TILE)*TILE + x%TILE) * 3;
+        }
+        Eigen::Vector3d operator()(std::int64_t x, std::int64_t y) const {
+            const float *t = texels + __index(x, y, xt);
+            return {t[0], t[1], t[2]};
+        }
+        // Bilinear, with (x, y) in texels and texel centres at .5.
+        Eigen::Vector3d bilinear(double x, double y) const {
+            x -= .5; y -= .5;
+            double fx = std::floor(x), fy = std::floor(y);
+            double wx = x - fx, wy = y - fy;
+            std::int64_t x0 = std::clamp<std::int64_t>(fx, 0, xs-1);
+            std::int64_t x1 = std::clamp<std::int64_t>(fx+1, 0, xs-1);
+            std::int64_t y0 = std::clamp<std::int64_t>(fy, 0, ys-1);
+            std::int64_t y1 = std::clamp<std::int64_t>(fy+1, 0, ys-1);
+            return (1.-wy) * ((1.-wx)*(*this)(x0, y0) + wx*(*this)(x1, y0))
+                + wy * ((1.-wx)*(*this)(x0, y1) + wx*(*this)(x1, y1));
+        }
+    };
+    std::shared_ptr<const void> map; std::vector<Level> levels;
+    std::int64_t xs = 0, ys = 0;
+
+    static std::int64_t __levels(std::int64_t xs, std::int64_t ys) {
+        std::int64_t n = 1;
+        for (; xs > 1 || ys > 1; ++n) {
+            xs = (xs+1) / 2; ys = (ys+1) / 2;
+        }
+        return n;
+    }
+    static std::size_t __size(std::int64_t xs, std::int64_t ys) {
+        std::size_t size = sizeof(Header);
+        for (std::int64_t l=__levels(xs, ys); l>0; --l) {
+            size += Level::__size(xs, ys) * sizeof(float);
+            xs = (xs+1) / 2; ys = (ys+1) / 2;
+        }
+        return size;
+    }
+    // Maps `filename`; false, with the reason on stderr, if it cannot be
+    // read or is not a texture of this version.
+    bool load(const std::string &filename) {
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0) {
+            std::perror(filename.c_str());
+            return false;
+        }
+        off_t size = ::lseek(fd, 0, SEEK_END);
+        void *p = size >= off_t(sizeof(Header)) ? ::mmap(nullptr, size,
+                PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+        ::close(fd);
+        Header header;
+        if (p != MAP_FAILED)
+            std::memcpy(&header, p, sizeof(Header));
+        if (p == MAP_FAILED || std::memcmp(header.magic, MAGIC, 8)
+                || header.version != VERSION || header.tile != TILE
+                || header.xs <= 0 || header.ys <= 0
+                || header.levels != __levels(header.xs, header.ys)
+                || std::size_t(size) != __size(header.xs, header.ys)) {
+            std::fprintf(stderr, "%s: not a texture of this version\n",
+                    filename.c_str());
+            if (p != MAP_FAILED)
+                ::munmap(p, size);
+            return false;
+        }
+        map.reset(p, [size](const void *q) {
+            ::munmap(const_cast<void *>(q), size);
+        });
+        xs = header.xs; ys = header.ys; levels.clear();
+        const float *texels = reinterpret_cast<const float *>(
+                static_cast<const char *>(p) + sizeof(Header));
+        for (std::int64_t l=0, x=xs, y=ys; l<header.levels; ++l) {
+            levels.push_back({x, y, (x+TILE-1) / TILE, texels});
+            texels += Level::__size(x, y);
+            x = (x+1) / 2; y = (y+1) / 2;
+        }
+        return true;
+    }
+    // Trilinear lookup at (x, y) in level-0 texels and level of detail
+    // `lod`, where level l has texels 2^l times as wide.
+    Eigen::Vector3d sample(double x, double y, double lod = 0.) const {
+        lod = std::clamp(lod, 0., double(levels.size()-1));
+        std::size_t l = lod; double w = lod - l;
+        auto at = [&](std::size_t l) {
+            const Level &level = levels[l];
+            return level.bilinear(x*level.xs/xs, y*level.ys/ys);
+        };
+        return w > 0. ? ((1.-w)*at(l) + w*at(l+1)).eval() : at(l);
+    }
+    // Feeds the size and the texels of the levels of at most 16 by 16 to
+    // `add`: enough to tell textures apart, as the 1x1 level is the mean
+    // of the whole image, without reading the full-size levels.
+    template<class F> void identify(F &&add) const {
+        add(double(xs)); add(double(ys));
+        for (auto &level : levels)
+            if (level.xs <= 16 && level.ys <= 16)
+                for (std::int64_t y=0; y<level.ys; ++y)
+                    for (std::int64_t x=0; x<level.xs; ++x) {
+                        Eigen::Vector3d t = level(x, y);
+                        add(t.x()); add(t.y()); add(t.z());
+                    }
+    }
+    // Writes xs by ys row-major BGR pixels as a texture file, through a
+    // temporary file renamed over `filename`.
+    static bool write(const std::string &filename, std::int64_t xs,
+            std::int64_t ys, std::vector<Eigen::Vector3d> pixels) {
+        std::string tmp = filename + ".tmp";
+        std::FILE *file = std::fopen(tmp.c_str(), "wb");
+        if (!file)
+            return false;
+        Header header{{}, VERSION, xs, ys, __levels(xs, ys), TILE, {}};
+        std::memcpy(header.magic, MAGIC, 8);
+        bool done = std::fwrite(&header, sizeof(Header), 1, file) == 1;
+        std::vector<float> texels;
+        for (std::int64_t l=0; l<header.levels; ++l) {
+            std::int64_t xt = (xs+TILE-1) / TILE;
+            texels.assign(Level::__size(xs, ys), 0.f);
+            for (std::int64_t y=0; y<ys; ++y)
+                for (std::int64_t x=0; x<xs; ++x)
+                    for (int c=0; c<3; ++c)
+                        texels[Level::__index(x, y, xt) + c]
+                            = pixels[y*xs+x][c];
+            done = done && std::fwrite(texels.data(), sizeof(float),
+                    texels.size(), file) == texels.size();
+            std::int64_t nx = (xs+1) / 2, ny = (ys+1) / 2;
+            std::vector<Eigen::Vector3d> next(nx*ny);
+            for (std::int64_t y=0; y<ny; ++y)
+                for (std::int64_t x=0; x<nx; ++x) {
+                    std::int64_t x0 = 2*x, x1 = std::min(2*x+1, xs-1);
+                    std::int64_t y0 = 2*y, y1 = std::min(2*y+1, ys-1);
+                    next[y*nx+x] = (pixels[y0*xs+x0] + pixels[y0*xs+x1]
+                        + pixels[y1*xs+x0] + pixels[y1*xs+x1]) / 4.;
+                }
+            pixels.swap(next); xs = nx; ys = ny;
+        }
+        done = std::fclose(file) == 0 && done;
+        return done && std::rename(tmp.c_str(), filename.c_str()) == 0;
+    }
+};